@@ -0,0 +1,544 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Headless benchmark of the window management code. dwm.c is built against
+ * the stub Xlib, drw and status engine below, which answer every request
+ * from memory and count them, and scripted workloads are fed to its event
+ * handlers. Run it with make bench.
+ */
+#define XLIB_ILLEGAL_ACCESS /* to fake the Display */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+
+static unsigned long nallocs, nrequests, nroundtrips;
+static unsigned long startallocs, startrequests, startroundtrips;
+static long long starttime;
+static long long sleptns; /* time poll() pretended to wait */
+
+static void *
+bench_calloc(size_t nmemb, size_t size)
+{
+	nallocs++;
+	return calloc(nmemb, size);
+}
+
+static void *
+bench_realloc(void *p, size_t size)
+{
+	nallocs++;
+	return realloc(p, size);
+}
+
+/* the pacing of drags must not make the benchmark sleep */
+static int
+bench_poll(struct pollfd *fds, nfds_t n, int timeout)
+{
+	sleptns += timeout > 0 ? timeout * 1000000LL : 0;
+	return 0;
+}
+
+static int
+bench_clock_gettime(clockid_t id, struct timespec *ts)
+{
+	int r = clock_gettime(id, ts);
+
+	ts->tv_sec += sleptns / 1000000000;
+	ts->tv_nsec += sleptns % 1000000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+	return r;
+}
+
+#undef XINERAMA
+#undef XCB
+#undef XSYNC
+#undef XRANDR
+#define calloc(nmemb, size) bench_calloc(nmemb, size)
+#define realloc(p, size) bench_realloc(p, size)
+#define poll(fds, n, timeout) bench_poll(fds, n, timeout)
+#define clock_gettime(id, ts) bench_clock_gettime(id, ts)
+#define main dwmmain
+#include "util.c"
+#include "dwm.c"
+#undef main
+#undef calloc
+#undef realloc
+#undef clock_gettime
+
+#define REQ(ret)                { nrequests++; return ret; }
+#define ROUNDTRIP(ret)          { nrequests++; nroundtrips++; return ret; }
+
+enum { BenchWidth = 1920, BenchHeight = 1080 };
+
+static struct _XDisplay benchdpy;
+static Screen benchscreen;
+static Visual benchvisual;
+static XID lastid = 0x200000;
+static Atom lastatom = XA_LAST_PREDEFINED;
+static Window selowner;
+static unsigned long titlegen; /* changes the titles handed out */
+static int ptrx, ptry;
+static XEvent *script;         /* events handed out by XMaskEvent() */
+static int nscript, scriptpos;
+
+Display *
+XOpenDisplay(const char *name)
+{
+	benchscreen.display = &benchdpy;
+	benchscreen.root = ++lastid;
+	benchscreen.width = BenchWidth;
+	benchscreen.height = BenchHeight;
+	benchscreen.root_depth = 24;
+	benchscreen.root_visual = &benchvisual;
+	benchdpy.fd = -1;
+	benchdpy.nscreens = 1;
+	benchdpy.screens = &benchscreen;
+	return &benchdpy;
+}
+
+int XCloseDisplay(Display *d) { return 0; }
+int XSupportsLocale(void) { return True; }
+XErrorHandler XSetErrorHandler(XErrorHandler h) { return NULL; }
+int XFree(void *p) { free(p); return 1; }
+int XFlush(Display *d) { return 1; }
+int XPending(Display *d) { return 0; }
+int XEventsQueued(Display *d, int mode) { return 0; }
+int XRefreshKeyboardMapping(XMappingEvent *e) { return 1; }
+KeyCode XKeysymToKeycode(Display *d, KeySym k) { return 0; }
+void XFreeStringList(char **l) { }
+int XDisplayKeycodes(Display *d, int *min, int *max) { *min = 8; *max = 255; return 1; }
+
+int
+XFreeModifiermap(XModifierKeymap *m)
+{
+	free(m->modifiermap);
+	free(m);
+	return 1;
+}
+
+int
+XmbTextPropertyToTextList(Display *d, const XTextProperty *tp, char ***l, int *n)
+{
+	return XNoMemory;
+}
+
+/* every client is the same terminal, titled after its window id */
+int
+XGetTextProperty(Display *d, Window w, XTextProperty *tp, Atom atom)
+{
+	char buf[64];
+
+	nrequests++;
+	nroundtrips++;
+	snprintf(buf, sizeof buf, "~/src/dwm: window %lu (%lu)", w, titlegen);
+	tp->value = (unsigned char *)strdup(buf);
+	tp->encoding = XA_STRING;
+	tp->format = 8;
+	tp->nitems = strlen(buf);
+	return 1;
+}
+
+int
+XGetClassHint(Display *d, Window w, XClassHint *ch)
+{
+	nrequests++;
+	nroundtrips++;
+	ch->res_name = strdup("st");
+	ch->res_class = strdup("St");
+	return 1;
+}
+
+int
+XGetWindowAttributes(Display *d, Window w, XWindowAttributes *wa)
+{
+	nrequests++;
+	nroundtrips++;
+	memset(wa, 0, sizeof(*wa));
+	wa->width = 640;
+	wa->height = 480;
+	wa->map_state = IsViewable;
+	return 1;
+}
+
+int
+XGetWindowProperty(Display *d, Window w, Atom prop, long off, long len, Bool del,
+	Atom req, Atom *type, int *format, unsigned long *n, unsigned long *after,
+	unsigned char **p)
+{
+	nrequests++;
+	nroundtrips++;
+	*type = None;
+	*format = 0;
+	*n = *after = 0;
+	*p = NULL;
+	/* tray icons are mapped, version 0 */
+	if (prop == xatom[XembedInfo]) {
+		*type = prop;
+		*format = 32;
+		*n = 2;
+		*p = calloc(2, sizeof(long));
+		((long *)*p)[1] = XEMBED_MAPPED;
+	}
+	return Success;
+}
+
+int
+XQueryPointer(Display *d, Window w, Window *root, Window *child, int *rx, int *ry,
+	int *wx, int *wy, unsigned int *mask)
+{
+	nrequests++;
+	nroundtrips++;
+	*root = benchscreen.root;
+	*child = None;
+	*rx = *wx = ptrx;
+	*ry = *wy = ptry;
+	*mask = 0;
+	return True;
+}
+
+int
+XQueryTree(Display *d, Window w, Window *root, Window *parent, Window **children,
+	unsigned int *n)
+{
+	nrequests++;
+	nroundtrips++;
+	*root = *parent = benchscreen.root;
+	*children = NULL;
+	*n = 0;
+	return 1;
+}
+
+XModifierKeymap *
+XGetModifierMapping(Display *d)
+{
+	XModifierKeymap *m = calloc(1, sizeof(XModifierKeymap));
+
+	nrequests++;
+	nroundtrips++;
+	m->max_keypermod = 1;
+	m->modifiermap = calloc(8, sizeof(KeyCode));
+	return m;
+}
+
+KeySym *
+XGetKeyboardMapping(Display *d, KeyCode first, int count, int *skip)
+{
+	KeySym *syms = calloc(count, sizeof(KeySym));
+	int i;
+
+	/* the first keycodes carry the keysyms of keys */
+	nrequests++;
+	nroundtrips++;
+	*skip = 1;
+	for (i = 0; i < count && i < (int)LENGTH(keys); i++)
+		syms[i] = keys[i].keysym;
+	return syms;
+}
+
+Atom XInternAtom(Display *d, const char *name, Bool onlyifexists) ROUNDTRIP(++lastatom)
+Window XGetSelectionOwner(Display *d, Atom a) ROUNDTRIP(selowner)
+int XGetTransientForHint(Display *d, Window w, Window *t) ROUNDTRIP(0)
+XWMHints *XGetWMHints(Display *d, Window w) ROUNDTRIP(NULL)
+int XGetWMNormalHints(Display *d, Window w, XSizeHints *h, long *s) ROUNDTRIP(0)
+int XGetWMProtocols(Display *d, Window w, Atom **p, int *n) ROUNDTRIP(0)
+int XGrabPointer(Display *d, Window w, Bool oe, unsigned int m, int pm, int km,
+	Window c, Cursor cur, Time t) ROUNDTRIP(GrabSuccess)
+int XSync(Display *d, Bool discard) ROUNDTRIP(1)
+
+Window XCreateSimpleWindow(Display *d, Window p, int x, int y, unsigned int w,
+	unsigned int h, unsigned int bw, unsigned long b, unsigned long bg) REQ(++lastid)
+Window XCreateWindow(Display *d, Window p, int x, int y, unsigned int w, unsigned int h,
+	unsigned int bw, int depth, unsigned int class, Visual *v, unsigned long mask,
+	XSetWindowAttributes *wa) REQ(++lastid)
+GC XCreateGC(Display *d, Drawable dr, unsigned long mask, XGCValues *gv) REQ(NULL)
+int XSetSelectionOwner(Display *d, Atom a, Window w, Time t) { nrequests++; selowner = w; return 1; }
+int XAddToSaveSet(Display *d, Window w) REQ(1)
+int XAllowEvents(Display *d, int mode, Time t) REQ(1)
+int XChangeProperty(Display *d, Window w, Atom p, Atom t, int f, int m,
+	const unsigned char *data, int n) REQ(1)
+int XChangeWindowAttributes(Display *d, Window w, unsigned long m,
+	XSetWindowAttributes *wa) REQ(1)
+int XConfigureWindow(Display *d, Window w, unsigned int m, XWindowChanges *wc) REQ(1)
+int XDefineCursor(Display *d, Window w, Cursor c) REQ(1)
+int XDeleteProperty(Display *d, Window w, Atom p) REQ(1)
+int XDestroyWindow(Display *d, Window w) REQ(1)
+int XDrawRectangle(Display *d, Drawable dr, GC gc, int x, int y, unsigned int w,
+	unsigned int h) REQ(1)
+int XFreeGC(Display *d, GC gc) REQ(1)
+int XGrabButton(Display *d, unsigned int b, unsigned int m, Window w, Bool oe,
+	unsigned int em, int pm, int km, Window c, Cursor cur) REQ(1)
+int XGrabKey(Display *d, int k, unsigned int m, Window w, Bool oe, int pm, int km) REQ(1)
+int XGrabServer(Display *d) REQ(1)
+int XKillClient(Display *d, XID id) REQ(1)
+int XMapRaised(Display *d, Window w) REQ(1)
+int XMapWindow(Display *d, Window w) REQ(1)
+int XMoveResizeWindow(Display *d, Window w, int x, int y, unsigned int wd,
+	unsigned int h) REQ(1)
+int XMoveWindow(Display *d, Window w, int x, int y) REQ(1)
+int XRaiseWindow(Display *d, Window w) REQ(1)
+int XReparentWindow(Display *d, Window w, Window p, int x, int y) REQ(1)
+int XSelectInput(Display *d, Window w, long m) REQ(1)
+int XSendEvent(Display *d, Window w, Bool p, long m, XEvent *e) REQ(1)
+int XSetClassHint(Display *d, Window w, XClassHint *ch) REQ(1)
+int XSetCloseDownMode(Display *d, int m) REQ(1)
+int XSetInputFocus(Display *d, Window w, int r, Time t) REQ(1)
+int XSetWMHints(Display *d, Window w, XWMHints *h) REQ(1)
+int XSetWindowBorder(Display *d, Window w, unsigned long p) REQ(1)
+int XUngrabButton(Display *d, unsigned int b, unsigned int m, Window w) REQ(1)
+int XUngrabKey(Display *d, int k, unsigned int m, Window w) REQ(1)
+int XUngrabPointer(Display *d, Time t) REQ(1)
+int XUngrabServer(Display *d) REQ(1)
+int XUnmapWindow(Display *d, Window w) REQ(1)
+int XWarpPointer(Display *d, Window s, Window dw, int sx, int sy, unsigned int sw,
+	unsigned int sh, int dx, int dy) REQ(1)
+
+/* events come one at a time, as if each was handled before the next one
+ * was sent, and the script ends with a button release */
+int
+XMaskEvent(Display *d, long mask, XEvent *ev)
+{
+	if (scriptpos < nscript) {
+		*ev = script[scriptpos++];
+	} else {
+		memset(ev, 0, sizeof(*ev));
+		ev->type = ButtonRelease;
+	}
+	return 1;
+}
+
+int XNextEvent(Display *d, XEvent *ev) { return XMaskEvent(d, ~0L, ev); }
+int XCheckMaskEvent(Display *d, long mask, XEvent *ev) { return False; }
+Bool XCheckIfEvent(Display *d, XEvent *ev, Bool (*p)(Display *, XEvent *, XPointer), XPointer a) { return False; }
+
+/* drw renders nothing and counts its requests like Xlib's */
+Drw *
+drw_create(Display *d, int screen, Window root, unsigned int w, unsigned int h)
+{
+	Drw *drw = ecalloc(1, sizeof(Drw));
+
+	drw->dpy = d;
+	drw->screen = screen;
+	drw->root = root;
+	drw->w = w;
+	drw->h = h;
+	return drw;
+}
+
+Fnt *
+drw_fontset_create(Drw *drw, const char *fonts[], size_t fontcount)
+{
+	Fnt *f = ecalloc(1, sizeof(Fnt));
+
+	f->dpy = drw->dpy;
+	f->h = 16;
+	return drw->fonts = f;
+}
+
+void
+drw_free(Drw *drw)
+{
+	free(drw->fonts);
+	free(drw);
+}
+
+unsigned int
+drw_fontset_getwidth(Drw *drw, const char *text)
+{
+	return strlen(text) * 8;
+}
+
+int
+drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad,
+	const char *text, int invert)
+{
+	if (!w)
+		return x + drw_fontset_getwidth(drw, text) + lpad;
+	nrequests += 2; /* background and glyphs */
+	return x + w;
+}
+
+Clr *drw_scm_create(Drw *drw, const char *names[], size_t n) { return ecalloc(n, sizeof(Clr)); }
+void drw_scm_free(Drw *drw, Clr *scm, size_t n) { free(scm); }
+Cur *drw_cur_create(Drw *drw, int shape) { return ecalloc(1, sizeof(Cur)); }
+void drw_cur_free(Drw *drw, Cur *cursor) { free(cursor); }
+void drw_resize(Drw *drw, unsigned int w, unsigned int h) { drw->w = w; drw->h = h; }
+void drw_setscheme(Drw *drw, Clr *scm) { drw->scheme = scm; }
+void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled,
+	int invert) { nrequests++; }
+void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h) { nrequests++; }
+void drw_fontset_queue(Drw *drw, long cp) {}
+unsigned int drw_fontset_pending(Drw *drw) { return 0; }
+int drw_fontset_resolve(Drw *drw) { return 0; }
+void drw_fontset_loadcache(Drw *drw, const char *path) {}
+void drw_fontset_savecache(Drw *drw, const char *path) {}
+
+/* the status engine starts no children and opens no sockets, its text is
+ * fixed */
+void status_init(const StatusModule *mods, size_t modcount) {}
+void status_free(void) {}
+int status_pollfds(struct pollfd *fds, int n) { return 0; }
+int status_timeout(void) { return -1; }
+int status_battery(char *buf, size_t size, const char *arg) { return 0; }
+int status_clock(char *buf, size_t size, const char *arg) { return 0; }
+int status_volume(char *buf, size_t size, const char *arg) { return 0; }
+int status_wifi(char *buf, size_t size, const char *arg) { return 0; }
+
+int
+status_update(const struct pollfd *fds, int n, char *text, size_t size, const char *sep)
+{
+	if (text[0])
+		return 0;
+	snprintf(text, size, "BAT 80%%%sWIFI bench%sVOL 40%%", sep, sep);
+	return 1;
+}
+
+/* what the main loop does once the event queue is drained */
+static void
+bench_idle(void)
+{
+	ipcnotify();
+	updateclientlist();
+	updatesystray();
+	drawbars();
+}
+
+static void
+bench_send(int type, Window w, Atom atom)
+{
+	XEvent ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.type = type;
+	switch (type) {
+	case MapRequest:
+		ev.xmaprequest.window = w;
+		break;
+	case DestroyNotify:
+		ev.xdestroywindow.window = w;
+		break;
+	case PropertyNotify:
+		ev.xproperty.window = w;
+		ev.xproperty.atom = atom;
+		ev.xproperty.state = PropertyNewValue;
+		break;
+	case KeyPress: /* w is the keycode */
+		ev.xkey.keycode = w;
+		break;
+	case MappingNotify:
+		ev.xmapping.request = MappingKeyboard;
+		break;
+	case ClientMessage: /* w docks in the tray */
+		ev.xclient.window = systray->win;
+		ev.xclient.message_type = netatom[NetSystemTrayOP];
+		ev.xclient.format = 32;
+		ev.xclient.data.l[1] = SYSTEM_TRAY_REQUEST_DOCK;
+		ev.xclient.data.l[2] = w;
+		break;
+	}
+	handler[type](&ev);
+	bench_idle();
+}
+
+static long long
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_start(void)
+{
+	startallocs = nallocs;
+	startrequests = nrequests;
+	startroundtrips = nroundtrips;
+	starttime = bench_now();
+}
+
+static void
+bench_report(const char *name, unsigned long ops)
+{
+	printf("%-8s %7lu %12.0f %10.2f %10.2f %10.2f\n", name, ops,
+		(double)(bench_now() - starttime) / ops,
+		(double)(nallocs - startallocs) / ops,
+		(double)(nrequests - startrequests) / ops,
+		(double)(nroundtrips - startroundtrips) / ops);
+}
+
+#define BENCH(name, ops, body) do { \
+	unsigned long op; \
+	bench_start(); \
+	for (op = 0; op < (ops); op++) { body; } \
+	bench_report(name, ops); \
+} while (0)
+
+int
+main(int argc, char *argv[])
+{
+	enum { Windows = 500, Flips = 10000, Titles = 10000, Motions = 1000,
+	       Keys = 10000, Keymaps = 100, Icons = 8 };
+	Window wins[Windows], icons[Icons];
+	Arg a;
+	int i;
+
+	unsetenv("XDG_RUNTIME_DIR"); /* no IPC socket */
+	dpy = XOpenDisplay(NULL);
+	setup();
+	for (i = 0; i < Windows; i++)
+		wins[i] = ++lastid;
+
+	printf("%-8s %7s %12s %10s %10s %10s\n", "workload", "ops", "ns/op",
+		"allocs/op", "reqs/op", "trips/op");
+	/* spread over the tags as they are mapped */
+	BENCH("manage", Windows, {
+		selmon->tagset[selmon->seltags] = 1 << (op % LENGTH(tags));
+		bench_send(MapRequest, wins[op], None);
+	});
+	BENCH("view", Flips, {
+		a.ui = 1 << (op % LENGTH(tags));
+		view(&a);
+		bench_idle();
+	});
+	BENCH("title", Titles, {
+		titlegen++;
+		bench_send(PropertyNotify, wins[op % Windows], XA_WM_NAME);
+	});
+
+	/* one drag moving the selected window by a pixel per motion event */
+	script = ecalloc(Motions, sizeof(XEvent));
+	for (i = 0; i < Motions; i++) {
+		script[i].type = MotionNotify;
+		script[i].xmotion.x = ptrx + i + 1;
+		script[i].xmotion.y = ptry + i / 2;
+	}
+	nscript = Motions;
+	bench_start();
+	movemouse(NULL);
+	bench_idle();
+	bench_report("drag", Motions);
+	free(script);
+
+	/* keys without their modifiers, only looked up */
+	BENCH("key", Keys, { bench_send(KeyPress, 8 + op % LENGTH(keys), None); });
+	BENCH("grabkeys", Keymaps, { bench_send(MappingNotify, None, None); });
+
+	/* XEMBED_INFO updates of docked icons not changing their state */
+	for (i = 0; i < Icons; i++) {
+		bench_send(ClientMessage, icons[i] = ++lastid, None);
+		bench_send(PropertyNotify, icons[i], xatom[XembedInfo]);
+	}
+	BENCH("tray", Titles, { bench_send(PropertyNotify, icons[op % Icons], xatom[XembedInfo]); });
+
+	BENCH("unmanage", Windows, { bench_send(DestroyNotify, wins[op], None); });
+	cleanup();
+	return EXIT_SUCCESS;
+}
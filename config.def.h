@@ -19,6 +19,13 @@ static const int topbar = 1;      /* 0 means bottom bar */
 static const int vertpad = 0;     /* vertical padding of bar */
 static const int sidepad = 0;     /* horizontal padding of bar */
 static const char *fonts[] = {"monospace:size=10"};
+/* codepoints whose fallback fonts are looked up right after startup */
+static const long fontprewarm[] = {
+    0x4E00,  /* CJK */
+    0x1F600, /* emoji */
+};
+static const int fontcache =
+    1; /* 1 means keep the fallback fonts found in $XDG_CACHE_HOME/dwm/fonts */
 static const char dmenufont[] = "monospace:size=10";
 static const char col_gray1[] = "#222222";
 static const char col_gray2[] = "#444444";
@@ -53,12 +60,37 @@ static const int lockfullscreen =
     1; /* 1 will force focus on the fullscreen window */
 static const int refreshrate =
     120; /* refresh rate (per second) for client move/resize */
+static const int dragoutline =
+    0; /* 1 means drag an outline and resize once on button release */
+static const int synctimeout =
+    100; /* ms to wait for a client to repaint while resizing it */
+static const int batchevents =
+    1; /* 1 means drop events superseded by a later queued one */
+static const int hidemode =
+    0; /* 1 means unmap clients of unselected tags instead of moving them off
+          screen */
+
+/* status */
+static const int builtinstatus =
+    1; /* 0 means show the root window name set by an external program */
+static const char statussep[] = " | ";
+static const StatusModule statusmods[] = {
+    /* function       argument                 interval  events */
+    {status_battery, "BAT0", 30, StatusPower},
+    {status_wifi, NULL, 10, StatusNet},
+    {status_volume, "@DEFAULT_SINK@", 0, StatusAudio},
+    {status_clock, "%Y-%m-%d %I:%M:%S %p", 1, 0},
+};
 
 static const Layout layouts[] = {
     /* symbol     arrange function */
     {"[]=", tile}, /* first entry is default */
     {"><>", NULL}, /* no layout function means floating behavior */
     {"[M]", monocle},
+    {"TTT", bstack},
+    {"|M|", centeredmaster},
+    {"[D]", deck},
+    {"###", grid},
 };
 
 /* key definitions */
@@ -113,6 +145,10 @@ static const Key keys[] = {
     {MODKEY, XK_m, spawn, {.v = volmute}},
     {MODKEY | ShiftMask, XK_m, setlayout, {.v = &layouts[2]}},
     {MODKEY, XK_w, spawn, {.v = wifitoggle}},
+    {MODKEY, XK_u, setlayout, {.v = &layouts[3]}},
+    {MODKEY, XK_o, setlayout, {.v = &layouts[4]}},
+    {MODKEY | ShiftMask, XK_d, setlayout, {.v = &layouts[5]}},
+    {MODKEY, XK_g, setlayout, {.v = &layouts[6]}},
     {MODKEY | ShiftMask, XK_space, togglefloating, {0}},
     {MODKEY, XK_0, view, {.ui = ~0}},
     {MODKEY | ShiftMask, XK_0, tag, {.ui = ~0}},
@@ -147,3 +183,30 @@ static const Button buttons[] = {
     {ClkTagBar, MODKEY, Button1, tag, {0}},
     {ClkTagBar, MODKEY, Button3, toggletag, {0}},
 };
+
+/* commands accepted on $XDG_RUNTIME_DIR/ipcsockname, see ipc.h */
+/* argument can be ArgNone, ArgInt, ArgUint, ArgFloat (in thousandths), or
+ * ArgLayout (an index in layouts, negative toggles the previous layout) */
+static const char ipcsockname[] = "dwm.sock"; /* empty disables the socket */
+static const Command commands[] = {
+    /* name           function        argument */
+    {"view", view, ArgUint},
+    {"toggleview", toggleview, ArgUint},
+    {"tag", tag, ArgUint},
+    {"toggletag", toggletag, ArgUint},
+    {"viewnext", viewnext, ArgNone},
+    {"viewprev", viewprev, ArgNone},
+    {"setlayout", setlayout, ArgLayout},
+    {"setmfact", setmfact, ArgFloat},
+    {"incnmaster", incnmaster, ArgInt},
+    {"focusstack", focusstack, ArgInt},
+    {"movestack", movestack, ArgInt},
+    {"focusmon", focusmon, ArgInt},
+    {"tagmon", tagmon, ArgInt},
+    {"zoom", zoom, ArgNone},
+    {"killclient", killclient, ArgNone},
+    {"togglefloating", togglefloating, ArgNone},
+    {"togglebar", togglebar, ArgNone},
+    {"quit", quit, ArgInt},
+    {"stats", stats, ArgInt},
+};
@@ -14,6 +14,18 @@ X11LIB = /usr/X11R6/lib
 XINERAMALIBS  = -lXinerama
 XINERAMAFLAGS = -DXINERAMA
 
+# XCB, comment if you don't want manage() to read window properties asynchronously
+XCBLIBS  = -lX11-xcb -lxcb
+XCBFLAGS = -DXCB
+
+# XSync, comment if you don't want resizes paced by the clients' repaints
+XSYNCLIBS  = -lXext
+XSYNCFLAGS = -DXSYNC
+
+# Xrandr, comment if you don't want monitors to follow single CRTC changes
+XRANDRLIBS  = -lXrandr
+XRANDRFLAGS = -DXRANDR
+
 # freetype
 FREETYPELIBS = -lfontconfig -lXft
 FREETYPEINC = /usr/include/freetype2
@@ -23,10 +35,10 @@ FREETYPEINC = /usr/include/freetype2
 
 # includes and libs
 INCS = -I${X11INC} -I${FREETYPEINC}
-LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${FREETYPELIBS}
+LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${XCBLIBS} ${XSYNCLIBS} ${XRANDRLIBS} ${FREETYPELIBS}
 
 # flags
-CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_XOPEN_SOURCE=700L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS}
+CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_XOPEN_SOURCE=700L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS} ${XCBFLAGS} ${XSYNCFLAGS} ${XRANDRFLAGS}
 #CFLAGS   = -g -std=c99 -pedantic -Wall -O0 ${INCS} ${CPPFLAGS}
 CFLAGS   = -std=c99 -pedantic -Wall -Wno-deprecated-declarations -Os ${INCS} ${CPPFLAGS}
 LDFLAGS  = ${LIBS}
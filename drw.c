@@ -9,6 +9,44 @@
 #include "util.h"
 
 #define UTF_INVALID 0xFFFD
+#define LATINGLYPHS 256
+#define FALLBACKSHIFT 7 /* fallback fonts are cached per 128 codepoints */
+#define CACHEHEADER "dwm fonts 1"
+
+typedef struct {
+	Fnt *font;        /* NULL: fill the background */
+	const char *str;
+	unsigned int len;
+	int x;
+	unsigned int w;   /* width of the fill */
+} TextRun;
+
+typedef struct {
+	char *text;       /* NULL if unused */
+	unsigned int hash, w;
+	int render;
+	Fnt *set;
+	TextRun *runs;
+	unsigned int nruns, runcap;
+	int advance;
+	unsigned long used;
+} TextLayout;
+
+typedef struct {
+	long block;       /* codepoint >> FALLBACKSHIFT */
+	char *name;       /* pattern of the font, opened without matching */
+} Fallback;
+
+static TextLayout layouts[32];
+static Fallback *fallbacks;
+static unsigned int nfallbacks, fallbackcap;
+static long pending[32]; /* codepoints no font of the set has, to look up */
+static unsigned int npending;
+/* keep track of a couple codepoints for which we have no match. */
+static long nomatches[128];
+static int cachedirty;
+static unsigned int ellipsis_width, invalid_width;
+static const char invalid[] = "�";
 
 static int
 utf8decode(const char *s_in, long *u, int *err)
@@ -46,6 +84,128 @@ utf8decode(const char *s_in, long *u, int *err)
 	return len;
 }
 
+static unsigned int
+glyph_hash(long cp)
+{
+	unsigned int hash = (unsigned int)cp;
+
+	hash = ((hash >> 16) ^ hash) * 0x21F0AAAD;
+	hash = ((hash >> 15) ^ hash) * 0xD35A2D97;
+	return (hash >> 15) ^ hash;
+}
+
+static Gly *
+glyph_get(Fnt *set, long cp)
+{
+	unsigned int i, mask = set->glyphcap - 1;
+
+	if (cp < LATINGLYPHS)
+		return set->latin && set->latin[cp].font ? &set->latin[cp] : NULL;
+	if (!set->glyphcap)
+		return NULL;
+	for (i = glyph_hash(cp) & mask; set->glyphs[i].font; i = (i + 1) & mask)
+		if (set->glyphs[i].cp == cp)
+			return &set->glyphs[i];
+	return NULL;
+}
+
+static void
+glyph_put(Fnt *set, long cp, Fnt *font, unsigned int w)
+{
+	unsigned int i, mask, oldcap = set->glyphcap;
+	Gly *g, *old = set->glyphs;
+
+	if (cp < LATINGLYPHS) {
+		if (!set->latin)
+			set->latin = ecalloc(LATINGLYPHS, sizeof(Gly));
+		g = &set->latin[cp];
+	} else {
+		/* keep the load factor below 3/4 */
+		if (4 * (set->nglyphs + 1) > 3 * set->glyphcap) {
+			set->glyphcap = oldcap ? oldcap * 2 : 64;
+			set->glyphs = ecalloc(set->glyphcap, sizeof(Gly));
+			set->nglyphs = 0;
+			for (i = 0; i < oldcap; i++)
+				if (old[i].font)
+					glyph_put(set, old[i].cp, old[i].font, old[i].w);
+			free(old);
+		}
+		mask = set->glyphcap - 1;
+		for (i = glyph_hash(cp) & mask; set->glyphs[i].font && set->glyphs[i].cp != cp; i = (i + 1) & mask);
+		g = &set->glyphs[i];
+		if (!g->font)
+			set->nglyphs++;
+	}
+	g->cp = cp;
+	g->w = w;
+	g->font = font;
+}
+
+static int
+nomatch_get(long cp)
+{
+	unsigned int hash = glyph_hash(cp);
+
+	return nomatches[hash % LENGTH(nomatches)] == cp
+	    || nomatches[(hash >> 17) % LENGTH(nomatches)] == cp;
+}
+
+static void
+nomatch_put(long cp)
+{
+	unsigned int hash = glyph_hash(cp), h0, h1;
+
+	h0 = hash % LENGTH(nomatches);
+	h1 = (hash >> 17) % LENGTH(nomatches);
+	nomatches[nomatches[h0] ? h1 : h0] = cp;
+}
+
+static Fallback *
+fallback_get(long block)
+{
+	unsigned int i;
+
+	for (i = 0; i < nfallbacks; i++)
+		if (fallbacks[i].block == block)
+			return &fallbacks[i];
+	return NULL;
+}
+
+static void
+fallback_put(long block, const char *name)
+{
+	Fallback *fb;
+	size_t len = strlen(name);
+
+	if (!(fb = fallback_get(block))) {
+		if (nfallbacks == fallbackcap) {
+			fallbackcap = fallbackcap ? fallbackcap * 2 : 16;
+			if (!(fallbacks = realloc(fallbacks, fallbackcap * sizeof(Fallback))))
+				die("realloc:");
+		}
+		fb = &fallbacks[nfallbacks++];
+		fb->block = block;
+		fb->name = NULL;
+	}
+	free(fb->name);
+	fb->name = ecalloc(len + 1, 1);
+	memcpy(fb->name, name, len);
+	cachedirty = 1;
+}
+
+static void
+text_flush(Fnt *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(layouts); i++)
+		if (layouts[i].set == set) {
+			free(layouts[i].text);
+			layouts[i].text = NULL;
+			layouts[i].set = NULL;
+		}
+}
+
 Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
 {
@@ -57,6 +217,8 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->w = w;
 	drw->h = h;
 	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable, DefaultVisual(dpy, screen),
+	                             DefaultColormap(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -74,15 +236,22 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	XftDrawChange(drw->xftdraw, drw->drawable);
 }
 
 void
 drw_free(Drw *drw)
 {
+	XftDrawDestroy(drw->xftdraw);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
 	free(drw);
+	while (nfallbacks)
+		free(fallbacks[--nfallbacks].name);
+	free(fallbacks);
+	fallbacks = NULL;
+	fallbackcap = npending = 0;
 }
 
 /* This function is an implementation detail. Library users should use
@@ -136,9 +305,77 @@ xfont_free(Fnt *font)
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
+	free(font->latin);
+	free(font->glyphs);
 	free(font);
 }
 
+/* opens a font from a pattern kept by fallback_match(), which has been
+ * matched and substituted already */
+static Fnt *
+fallback_open(Drw *drw, const char *name)
+{
+	FcPattern *pattern;
+	Fnt *font;
+
+	if (!(pattern = FcNameParse((FcChar8 *)name)))
+		return NULL;
+	if (!(font = xfont_create(drw, NULL, pattern)))
+		FcPatternDestroy(pattern);
+	return font;
+}
+
+/* asks fontconfig for a font having cp and caches its pattern for the block
+ * of cp, without the charset and languages read from the file on opening */
+static Fnt *
+fallback_match(Drw *drw, long cp)
+{
+	FcCharSet *fccharset;
+	FcPattern *fcpattern, *match;
+	FcChar8 *name;
+	XftResult result;
+	Fnt *font;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, cp);
+
+	fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+
+	FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+	FcDefaultSubstitute(fcpattern);
+	match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+
+	FcCharSetDestroy(fccharset);
+	FcPatternDestroy(fcpattern);
+
+	if (!match)
+		return NULL;
+	if (!(font = xfont_create(drw, NULL, match))) {
+		FcPatternDestroy(match);
+		return NULL;
+	}
+	if (!XftCharExists(drw->dpy, font->xfont, cp)) {
+		xfont_free(font);
+		return NULL;
+	}
+	fcpattern = FcPatternDuplicate(match);
+	FcPatternDel(fcpattern, FC_CHARSET);
+	FcPatternDel(fcpattern, FC_LANG);
+	if ((name = FcNameUnparse(fcpattern))) {
+		fallback_put(cp >> FALLBACKSHIFT, (char *)name);
+		free(name);
+	}
+	FcPatternDestroy(fcpattern);
+	return font;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -162,8 +399,129 @@ drw_fontset_free(Fnt *font)
 {
 	if (font) {
 		drw_fontset_free(font->next);
+		text_flush(font);
+		xfont_free(font);
+	}
+}
+
+/* queues cp for drw_fontset_resolve() */
+void
+drw_fontset_queue(Drw *drw, long cp)
+{
+	unsigned int i;
+
+	if (!drw || npending == LENGTH(pending) || nomatch_get(cp))
+		return;
+	for (i = 0; i < npending; i++)
+		if (pending[i] == cp)
+			return;
+	pending[npending++] = cp;
+}
+
+unsigned int
+drw_fontset_pending(Drw *drw)
+{
+	return drw ? npending : 0;
+}
+
+/* Looks up a fallback font for the first queued codepoint, trying the font
+ * cached for its block before matching. Returns 1 if a font was added to
+ * the set, text drawn before then has to be drawn again. */
+int
+drw_fontset_resolve(Drw *drw)
+{
+	Fallback *fb;
+	Fnt *font = NULL, *last;
+	long cp;
+
+	if (!drw || !drw->fonts || !npending)
+		return 0;
+	cp = pending[0];
+	memmove(pending, pending + 1, --npending * sizeof(long));
+	for (last = drw->fonts; ; last = last->next) {
+		if (XftCharExists(drw->dpy, last->xfont, cp))
+			return 0;
+		if (!last->next)
+			break;
+	}
+
+	if ((fb = fallback_get(cp >> FALLBACKSHIFT)) && (font = fallback_open(drw, fb->name))
+	&& !XftCharExists(drw->dpy, font->xfont, cp)) {
 		xfont_free(font);
+		font = NULL;
+	}
+	if (!font && !(font = fallback_match(drw, cp))) {
+		nomatch_put(cp);
+		return 0;
+	}
+	last->next = font;
+	text_flush(drw->fonts);
+	ellipsis_width = invalid_width = 0;
+	return 1;
+}
+
+/* the cache only holds for the first font it was made for */
+static FcChar8 *
+cache_key(Drw *drw)
+{
+	return drw && drw->fonts && drw->fonts->pattern
+		? FcNameUnparse(drw->fonts->pattern) : NULL;
+}
+
+void
+drw_fontset_loadcache(Drw *drw, const char *path)
+{
+	char line[4096], head[4096];
+	FcChar8 *key;
+	FILE *fp;
+	long v;
+	int n;
+
+	if (!(key = cache_key(drw)))
+		return;
+	snprintf(head, sizeof head, "%s %u %s\n", CACHEHEADER, drw->fonts->h, (char *)key);
+	free(key);
+	if (!(fp = fopen(path, "r")))
+		return;
+	if (!fgets(line, sizeof line, fp) || strcmp(line, head)) {
+		fclose(fp);
+		return;
+	}
+	while (fgets(line, sizeof line, fp)) {
+		line[strcspn(line, "\n")] = '\0';
+		n = 0;
+		if (sscanf(line, "f %ld %n", &v, &n) == 1 && n && line[n])
+			fallback_put(v, line + n);
 	}
+	fclose(fp);
+	cachedirty = 0;
+}
+
+/* writes the fallback fonts if they changed since drw_fontset_loadcache(),
+ * not the codepoints no font has, as a font installed later may have them */
+void
+drw_fontset_savecache(Drw *drw, const char *path)
+{
+	char tmp[4096];
+	FcChar8 *key;
+	FILE *fp;
+	unsigned int i;
+
+	if (!cachedirty || !(key = cache_key(drw)))
+		return;
+	snprintf(tmp, sizeof tmp, "%s.tmp", path);
+	if (!(fp = fopen(tmp, "w"))) {
+		free(key);
+		return;
+	}
+	fprintf(fp, "%s %u %s\n", CACHEHEADER, drw->fonts->h, (char *)key);
+	free(key);
+	for (i = 0; i < nfallbacks; i++)
+		fprintf(fp, "f %ld %s\n", fallbacks[i].block, fallbacks[i].name);
+	if (fclose(fp) == 0 && rename(tmp, path) == 0)
+		cachedirty = 0;
+	else
+		remove(tmp);
 }
 
 void
@@ -244,81 +602,99 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
 }
 
-int
-drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
+static unsigned int
+text_hash(const char *text)
 {
-	int ty, ellipsis_x = 0;
-	unsigned int tmpw, ew, ellipsis_w = 0, ellipsis_len, hash, h0, h1;
-	XftDraw *d = NULL;
+	unsigned int hash = 2166136261u;
+
+	while (*text)
+		hash = (hash ^ (unsigned char)*text++) * 16777619u;
+	return hash;
+}
+
+static void
+text_addrun(TextLayout *l, Fnt *font, const char *str, unsigned int len, int x, unsigned int w)
+{
+	if (l->nruns == l->runcap) {
+		l->runcap = l->runcap ? l->runcap * 2 : 8;
+		if (!(l->runs = realloc(l->runs, l->runcap * sizeof(TextRun))))
+			die("realloc:");
+	}
+	l->runs[l->nruns].font = font;
+	l->runs[l->nruns].str = str;
+	l->runs[l->nruns].len = len;
+	l->runs[l->nruns].x = x;
+	l->runs[l->nruns].w = w;
+	l->nruns++;
+}
+
+/* Splits text into runs of one font each, loading fallback fonts as needed.
+ * Positions are relative to the text origin. Without render only the
+ * advance is computed, w then clamps like drw_fontset_getwidth_clamp(). */
+static int
+text_layout(Drw *drw, TextLayout *l, int x, unsigned int w, const char *text, int render)
+{
+	int ellipsis_x = 0;
+	unsigned int tmpw, ew, ellipsis_w = 0, ellipsis_len;
 	Fnt *usedfont, *curfont, *nextfont;
-	int utf8strlen, utf8charlen, utf8err, render = x || y || w || h;
+	Gly *g;
+	int utf8strlen, utf8charlen, utf8err;
 	long utf8codepoint = 0;
 	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
 	int charexists = 0, overflow = 0;
-	/* keep track of a couple codepoints for which we have no match. */
-	static unsigned int nomatches[128], ellipsis_width, invalid_width;
-	static const char invalid[] = "�";
 
-	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
-		return 0;
-
-	if (!render) {
-		w = invert ? invert : ~invert;
-	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		if (w < lpad)
-			return x + w;
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
-		x += lpad;
-		w -= lpad;
-	}
+	if (render && !w)
+		return x;
 
 	usedfont = drw->fonts;
-	if (!ellipsis_width && render)
-		ellipsis_width = drw_fontset_getwidth(drw, "...");
-	if (!invalid_width && render)
-		invalid_width = drw_fontset_getwidth(drw, invalid);
 	while (1) {
 		ew = ellipsis_len = utf8err = utf8charlen = utf8strlen = 0;
 		utf8str = text;
 		nextfont = NULL;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, &utf8err);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
+			/* invalid sequences are measured by their bytes, don't cache them */
+			if (!charexists && !utf8err && (g = glyph_get(drw->fonts, utf8codepoint))) {
+				charexists = 1;
+				curfont = g->font;
+				tmpw = g->w;
+			} else if (charexists) {
+				/* no font has the glyph, draw it with the first one anyway */
+				curfont = drw->fonts;
+				drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
+			} else {
+				for (curfont = drw->fonts; curfont; curfont = curfont->next)
+					if (XftCharExists(drw->dpy, curfont->xfont, utf8codepoint))
+						break;
+				if ((charexists = curfont != NULL)) {
 					drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
-					if (ew + ellipsis_width <= w) {
-						/* keep track where the ellipsis still fits */
-						ellipsis_x = x + ew;
-						ellipsis_w = w - ew;
-						ellipsis_len = utf8strlen;
-					}
-
-					if (ew + tmpw > w) {
-						overflow = 1;
-						/* called from drw_fontset_getwidth_clamp():
-						 * it wants the width AFTER the overflow
-						 */
-						if (!render)
-							x += tmpw;
-						else
-							utf8strlen = ellipsis_len;
-					} else if (curfont == usedfont) {
-						text += utf8charlen;
-						utf8strlen += utf8err ? 0 : utf8charlen;
-						ew += utf8err ? 0 : tmpw;
-					} else {
-						nextfont = curfont;
-					}
-					break;
+					if (!utf8err)
+						glyph_put(drw->fonts, utf8codepoint, curfont, tmpw);
+				}
+			}
+			if (charexists) {
+				if (ew + ellipsis_width <= w) {
+					/* keep track where the ellipsis still fits */
+					ellipsis_x = x + ew;
+					ellipsis_w = w - ew;
+					ellipsis_len = utf8strlen;
+				}
+
+				if (ew + tmpw > w) {
+					overflow = 1;
+					/* called from drw_fontset_getwidth_clamp():
+					 * it wants the width AFTER the overflow
+					 */
+					if (!render)
+						x += tmpw;
+					else
+						utf8strlen = ellipsis_len;
+				} else if (curfont == usedfont) {
+					text += utf8charlen;
+					utf8strlen += utf8err ? 0 : utf8charlen;
+					ew += utf8err ? 0 : tmpw;
+				} else {
+					nextfont = curfont;
 				}
 			}
 
@@ -329,22 +705,23 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		}
 
 		if (utf8strlen) {
-			if (render) {
-				ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-				XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-				                  usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
-			}
+			if (render)
+				text_addrun(l, usedfont, utf8str, utf8strlen, x, 0);
 			x += ew;
 			w -= ew;
 		}
 		if (utf8err && (!render || invalid_width < w)) {
-			if (render)
-				drw_text(drw, x, y, w, h, 0, invalid, invert);
+			if (render) {
+				text_addrun(l, NULL, NULL, 0, x, w);
+				text_layout(drw, l, x, w, invalid, 1);
+			}
 			x += invalid_width;
 			w -= invalid_width;
 		}
-		if (render && overflow)
-			drw_text(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert);
+		if (render && overflow && ellipsis_w) {
+			text_addrun(l, NULL, NULL, 0, ellipsis_x, ellipsis_w);
+			text_layout(drw, l, ellipsis_x, ellipsis_w, "...", 1);
+		}
 
 		if (!*text || overflow) {
 			break;
@@ -352,57 +729,93 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 			charexists = 0;
 			usedfont = nextfont;
 		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
+			/* The character is drawn with the first font until
+			 * drw_fontset_resolve() found a fallback font having it,
+			 * matching is kept out of the draw path. */
 			charexists = 1;
+			drw_fontset_queue(drw, utf8codepoint);
+			usedfont = drw->fonts;
+		}
+	}
 
-			hash = (unsigned int)utf8codepoint;
-			hash = ((hash >> 16) ^ hash) * 0x21F0AAAD;
-			hash = ((hash >> 15) ^ hash) * 0xD35A2D97;
-			h0 = ((hash >> 15) ^ hash) % LENGTH(nomatches);
-			h1 = (hash >> 17) % LENGTH(nomatches);
-			/* avoid expensive XftFontMatch call when we know we won't find a match */
-			if (nomatches[h0] == utf8codepoint || nomatches[h1] == utf8codepoint)
-				goto no_match;
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
+	return x + (render ? w : 0);
+}
 
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+/* Returns the cached layout of text for the current font set, laying it
+ * out on a miss. The least recently used entry is replaced. */
+static TextLayout *
+text_get(Drw *drw, const char *text, unsigned int w, int render)
+{
+	static unsigned long clock;
+	unsigned int i, hash;
+	size_t len;
+	TextLayout *l, *lru = &layouts[0];
 
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+	if (!ellipsis_width && render)
+		ellipsis_width = text_get(drw, "...", ~0u, 0)->advance;
+	if (!invalid_width && render)
+		invalid_width = text_get(drw, invalid, ~0u, 0)->advance;
+
+	hash = text_hash(text);
+	for (i = 0; i < LENGTH(layouts); i++) {
+		l = &layouts[i];
+		if (l->text && l->hash == hash && l->w == w && l->render == render
+		&& l->set == drw->fonts && !strcmp(l->text, text)) {
+			l->used = ++clock;
+			return l;
+		}
+		if (l->used < lru->used)
+			lru = l;
+	}
 
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
+	l = lru;
+	free(l->text);
+	len = strlen(text);
+	l->text = ecalloc(len + 1, 1);
+	memcpy(l->text, text, len);
+	l->hash = hash;
+	l->w = w;
+	l->render = render;
+	l->set = drw->fonts;
+	l->nruns = 0;
+	l->used = ++clock;
+	l->advance = text_layout(drw, l, 0, w, l->text, render);
+	return l;
+}
 
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					nomatches[nomatches[h0] ? h1 : h0] = utf8codepoint;
-no_match:
-					usedfont = drw->fonts;
-				}
-			}
+int
+drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
+{
+	int ty, render = x || y || w || h;
+	unsigned int i;
+	TextLayout *l;
+	TextRun *r;
+
+	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
+		return 0;
+
+	if (!render)
+		return text_get(drw, text, invert ? invert : ~invert, 0)->advance;
+
+	XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
+	XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+	if (w < lpad)
+		return x + w;
+	l = text_get(drw, text, w - lpad, 1);
+	x += lpad;
+	for (i = 0; i < l->nruns; i++) {
+		r = &l->runs[i];
+		if (!r->font) {
+			/* background under the ellipsis and invalid glyph markers */
+			XFillRectangle(drw->dpy, drw->drawable, drw->gc, x + r->x, y, r->w, h);
+			continue;
 		}
+		ty = y + (h - r->font->h) / 2 + r->font->xfont->ascent;
+		XftDrawStringUtf8(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
+		                  r->font->xfont, x + r->x, ty, (XftChar8 *)r->str, r->len);
 	}
-	if (d)
-		XftDrawDestroy(d);
 
-	return x + (render ? w : 0);
+	return x + l->advance;
 }
 
 void
@@ -412,7 +825,6 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 		return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
 }
 
 unsigned int
@@ -4,12 +4,22 @@ typedef struct {
 	Cursor cursor;
 } Cur;
 
+typedef struct {
+	long cp;          /* codepoint */
+	unsigned int w;   /* advance width */
+	struct Fnt *font; /* first font of the set having the glyph, NULL if unused */
+} Gly;
+
 typedef struct Fnt {
 	Display *dpy;
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
 	struct Fnt *next;
+	/* glyph cache, only used on the first font of a set */
+	Gly *latin;        /* direct-mapped, codepoints below 256 */
+	Gly *glyphs;       /* open addressing, all other codepoints */
+	unsigned int nglyphs, glyphcap;
 } Fnt;
 
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
@@ -21,6 +31,7 @@ typedef struct {
 	int screen;
 	Window root;
 	Drawable drawable;
+	XftDraw *xftdraw;
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
@@ -38,6 +49,13 @@ unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 unsigned int drw_fontset_getwidth_clamp(Drw *drw, const char *text, unsigned int n);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
 
+/* Fallback fonts */
+void drw_fontset_queue(Drw *drw, long cp);
+unsigned int drw_fontset_pending(Drw *drw);
+int drw_fontset_resolve(Drw *drw);
+void drw_fontset_loadcache(Drw *drw, const char *path);
+void drw_fontset_savecache(Drw *drw, const char *path);
+
 /* Colorscheme abstraction */
 void drw_clr_create(Drw *drw, Clr *dest, const char *clrname);
 void drw_clr_free(Drw *drw, Clr *c);
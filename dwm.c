@@ -14,20 +14,26 @@
  * set the override_redirect flag. Clients are organized in a linked client
  * list on each monitor, the focus history is remembered through a stack list
  * on each monitor. Each client contains a bit array to indicate the tags of a
- * client.
+ * client. Clients and systray icons are also kept in a hash table keyed by
+ * window, so looking up the client of an event window is O(1).
  *
  * Keys and tagging rules are organized as arrays and defined in config.h.
  *
  * To understand everything else, start reading main().
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
@@ -39,9 +45,23 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
+#ifdef XSYNC
+#include <X11/extensions/sync.h>
+#endif /* XSYNC */
 #include <X11/Xft/Xft.h>
+#ifdef XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#endif /* XCB */
 
 #include "drw.h"
+#include "ipc.h"
+#include "layout.h"
+#include "match.h"
+#include "status.h"
 #include "util.h"
 
 /* macros */
@@ -56,6 +76,13 @@
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw + gappx)
 #define TAGMASK                 ((1 << LENGTH(tags)) - 1)
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad)
+#define BARSEGS                 34 /* status, up to 31 tags, layout symbol, title */
+#define EVBATCHSIZE             256
+#define MAXWATCHES              32
+#define CLIENTSLAB              32 /* Client records allocated at once */
+#define STATEVERSION            1 /* of the state kept across a restart */
+#define WINHASHSIZE             256 /* must be a power of two */
+#define WINHASH(W)              (((W) ^ ((W) >> 16)) & (WINHASHSIZE - 1))
 
 #define SYSTEM_TRAY_REQUEST_DOCK    0
 /* XEMBED messages */
@@ -76,11 +103,17 @@ enum { SchemeNorm, SchemeSel }; /* color schemes */
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetSystemTray, NetSystemTrayOP, NetSystemTrayOrientation, NetSystemTrayOrientationHorz,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWindowTypeDialog, NetClientList, NetLast }; /* EWMH atoms */
+       NetWMWindowTypeDialog, NetClientList, NetClientListStacking, NetLast }; /* EWMH atoms */
 enum { Manager, Xembed, XembedInfo, XLast }; /* Xembed atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { TimerStatus, TimerStats, TimerFonts, TimerLast }; /* timers */
+enum { ArgNone, ArgInt, ArgUint, ArgFloat, ArgLayout }; /* command arguments */
+enum { MonNum, MonTags0, MonTags1, MonSeltags, MonSellt, MonLt0, MonLt1,
+       MonNmaster, MonMfact, MonShowbar, MonLast }; /* saved monitor fields */
+enum { CliWin, CliMon, CliTags, CliFloating, CliX, CliY, CliW, CliH,
+       CliLast }; /* saved client fields */
 
 typedef union {
 	int i;
@@ -97,21 +130,45 @@ typedef struct {
 	const Arg arg;
 } Button;
 
+typedef struct {
+	const char *name;
+	void (*func)(const Arg *arg);
+	int argtype;
+} Command;
+
 typedef struct Monitor Monitor;
 typedef struct Client Client;
 struct Client {
-	char name[256];
-	float mina, maxa;
+	/* read by the layouts and visibility checks, kept in front */
 	int x, y, w, h;
-	int oldx, oldy, oldw, oldh;
-	int basew, baseh, incw, inch, maxw, maxh, minw, minh, hintsvalid;
-	int bw, oldbw;
+	int sx, sy; /* position last applied to the window */
+	int bw;
 	unsigned int tags;
-	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen;
+	int isfixed, isfloating, isurgent, neverfocus, isfullscreen;
+	int bare; /* tiled alone in the window area, drawn without border */
+	int hidden; /* unmapped by showhide(), see hidemode */
 	Client *next;
 	Client *snext;
+	Client *hnext; /* window hash chain */
 	Monitor *mon;
 	Window win;
+	/* read on resizes and property changes only */
+	float mina, maxa;
+	int basew, baseh, incw, inch, maxw, maxh, minw, minh, hintsvalid;
+	int hintw, hinth, hintcw, hintch; /* last size constrained by the hints, the result */
+#ifdef XCB
+	xcb_get_property_cookie_t hintsck; /* WM_NORMAL_HINTS read by propertynotify(), 0 if none */
+#endif /* XCB */
+	int oldx, oldy, oldw, oldh;
+	int oldbw, oldstate;
+	unsigned long unmapserial; /* of the last unmap by showhide() */
+	char name[256];
+};
+
+typedef struct ClientSlab ClientSlab;
+struct ClientSlab {
+	ClientSlab *next;
+	Client clients[CLIENTSLAB];
 };
 
 typedef struct {
@@ -121,15 +178,32 @@ typedef struct {
 	const Arg arg;
 } Key;
 
+typedef struct {
+	unsigned int mod; /* cleaned */
+	const Key *key;
+} KeyBind;
+
 typedef struct {
 	const char *symbol;
-	void (*arrange)(Monitor *);
+	void (*arrange)(const LayoutArgs *a, Rect *r); /* NULL means floating */
 } Layout;
 
+typedef struct {
+	int x, w;
+	unsigned int state, drawn; /* drawn 0 forces a repaint */
+	char text[256];
+} BarSeg;
+
 struct Monitor {
 	char ltsymbol[16];
 	float mfact;
 	int nmaster;
+	unsigned int nvis, ntiled, clientcap;
+	Client **vis;         /* visible clients in client list order */
+	Client **tiled;       /* the tiled ones among them */
+	Rect *rects;          /* laid out for the tiled ones */
+	unsigned int occ, urg; /* tags having clients, having urgent clients */
+	int clientsdirty;     /* the above need a rebuild */
 	int num;
 	int by;               /* bar geometry */
 	int mx, my, mw, mh;   /* screen size */
@@ -139,20 +213,87 @@ struct Monitor {
 	unsigned int tagset[2];
 	int showbar;
 	int topbar;
+	int bardirty;         /* bar needs a repaint once the event queue drains */
+	int resized;          /* geometry changed, see updatemons() */
+#ifdef XRANDR
+	RRCrtc crtc;          /* showing the monitor, None if not known */
+#endif /* XRANDR */
 	Client *clients;
 	Client *sel;
 	Client *stack;
 	Monitor *next;
 	Window barwin;
+	BarSeg barsegs[BARSEGS]; /* last drawn bar segments */
+	IPCEventMsg ipcstate;    /* last state sent to IPC subscribers */
 	const Layout *lt[2];
 };
 
+typedef struct {
+	int *xs, *ys;         /* sorted edges of the window areas */
+	int nx, ny;
+	Monitor **cells;      /* nx - 1 by ny - 1, NULL if in no window area */
+	int dirty;
+} MonIndex;
+
 typedef struct Systray   Systray;
 struct Systray {
 	Window win;
 	Client *icons;
+	Monitor *mon;     /* the tray window was last configured for */
+	int x, y, w;      /* of the tray window, w is 0 while it is unmapped */
 };
 
+typedef struct {
+	Client *c;
+	int x, y, w, h;       /* newest geometry asked for */
+	int pending;          /* it is not applied yet */
+	int outline;          /* it is drawn as an outline until the drag ends */
+	int drawn;            /* the outline is visible */
+	long long last;       /* when a geometry was last applied */
+	GC gc;
+#ifdef XSYNC
+	XSyncCounter counter; /* the client acks a repaint on, None if none */
+	XSyncValue value;     /* last value asked for */
+	int waiting;          /* the client has not reached it yet */
+	XSyncAlarm alarm;     /* reports the counter reaching value */
+#endif /* XSYNC */
+} Drag;
+
+typedef struct {
+	long long due; /* monotonic ms, -1 means disarmed */
+	void (*func)(void);
+} Timer;
+
+typedef struct {
+	unsigned long count, reqs;
+	unsigned long syncs; /* calls having read from the server */
+	long long ns, maxns;
+} Stat;
+
+typedef struct {
+	long long ns;
+	unsigned long req, seen;
+} Trace;
+
+typedef struct {
+	int fd;
+	void (*func)(int fd);
+} Watch;
+
+typedef struct {
+	Window *w;
+	int n, cap;
+} WinList;
+
+typedef struct {
+	char name[256];
+	Window trans;
+	char class[256], instance[256];
+	Atom state, wtype;
+	XSizeHints size;
+	XWMHints wmh;
+} WinProps; /* properties of a window read by manage() */
+
 typedef struct {
 	const char *class;
 	const char *instance;
@@ -163,95 +304,172 @@ typedef struct {
 } Rule;
 
 /* function declarations */
-static void applyrules(Client *c);
+static int addwatch(int fd, void (*func)(int fd));
+static Client *allocclient(void);
+static void applyrules(Client *c, const char *class, const char *instance);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
 static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachaside(Client *c);
+static void attachhash(Client **tab, Client *c);
 static void attachstack(Client *c);
 static void buttonpress(XEvent *e);
 static void checkotherwm(void);
+static void circulatenotify(XEvent *e);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
 static void clientmessage(XEvent *e);
+static void compilerules(void);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
 static Monitor *createmon(void);
+static void createnotify(XEvent *e);
+static void delwatch(int fd);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
+static void detachhash(Client **tab, Client *c);
 static void detachstack(Client *c);
+static void discardevents(int type);
 static Monitor *dirtomon(int dir);
+static void dragbegin(Drag *d, Client *c);
+static void dragend(Drag *d);
+static void dragevent(Drag *d, XEvent *ev, long mask);
+static int dragready(Drag *d);
+#ifdef XSYNC
+static void dragsync(Drag *d);
+#endif /* XSYNC */
+static void dragto(Drag *d, int x, int y, int w, int h);
 static void drawbar(Monitor *m);
 static void drawbars(void);
+static void drawoutline(Drag *d, int show);
+static void dumpstats(void);
 static void enternotify(XEvent *e);
+static Window evwindow(XEvent *ev);
 static void expose(XEvent *e);
+static void fetchprops(Window w, WinProps *p);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
-static Atom getatomprop(Client *c, Atom prop);
+static void fonttimer(void);
+static void freeclient(Client *c);
+static Atom getatomprop(Window w, Atom prop);
 static int getrootptr(int *x, int *y);
+#ifndef XCB
 static long getstate(Window w);
+#endif /* XCB */
 static unsigned int getsystraywidth(void);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
 static void incnmaster(const Arg *arg);
+#ifdef XRANDR
+static void initrandr(void);
+#endif /* XRANDR */
+static int intcmp(const void *a, const void *b);
+static void ipcaccept(int fd);
+static void ipcclient(int fd);
+static void ipcnotify(void);
+static Bool ismotion(Display *dpy, XEvent *ev, XPointer released);
+static int keycmp(const void *a, const void *b);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
-static void manage(Window w, XWindowAttributes *wa);
+static void listinsert(WinList *l, int i, Window w);
+static int listremove(WinList *l, Window w);
+static void loadstate(void);
+static void manage(Window w, XWindowAttributes *wa, WinProps *p);
+static void markbar(Monitor *m);
+static void markclients(Monitor *m);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
-static void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
+static void movewin(Client *c, int x, int y);
+static int nextmotion(XEvent *ev);
 static Client *nexttagged(Client *c);
 static Client *nexttiled(Client *c);
+static Client *nextvisible(Monitor *m, Client *c, int dir, int tiled);
+static Monitor *pointtomon(int x, int y);
+static void pollwatches(int timeout);
 static void pop(Client *c);
 static void propertynotify(XEvent *e);
 static void quit(const Arg *arg);
+static void raisewin(Window w);
+static void readevents(void);
 static Monitor *recttomon(int x, int y, int w, int h);
+#if defined(XINERAMA) || defined(XRANDR)
+static void removemon(Monitor *m);
+#endif
 static void removesystrayicon(Client *i);
+static void reparentnotify(XEvent *e);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizebarwin(Monitor *m);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void resizerequest(XEvent *e);
 static void restack(Monitor *m);
+static void restackwin(Window w, Window sibling);
+static int restoreclient(Client *c);
+static void restoreorder(void);
+#ifdef XRANDR
+static void rrnotify(XEvent *e);
+#endif /* XRANDR */
 static void run(void);
+static int runcommand(const IPCCommandMsg *cmd);
+static void savefonts(void);
+static void savestate(void);
 static void scan(void);
 static int sendevent(Window w, Atom proto, int m, long d0, long d1, long d2, long d3, long d4);
 static void sendmon(Client *c, Monitor *m);
+static int setbarseg(BarSeg *s, int x, int w, const char *text, unsigned int state);
 static void setclientstate(Client *c, long state);
 static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setlayout(const Arg *arg);
 static void setmfact(const Arg *arg);
+static void setsizehints(Client *c, XSizeHints *size);
+static void settimer(int id, int ms);
 static void setup(void);
 static void seturgent(Client *c, int urg);
+static void setwindowtype(Client *c, Atom state, Atom wtype);
+static void setwmhints(Client *c, XWMHints *wmh);
 static void showhide(Client *c);
 static void sighup(int unused);
 static void sigterm(int unused);
+static int sortedges(int *v, int n);
 static void spawn(const Arg *arg);
+static void stackabove(Window w, Window sibling);
+static int stacked(Window w, Window sibling);
+static void stats(const Arg *arg);
+static void statstimer(void);
+static void statusevent(int fd);
+static void statustimer(void);
+static int supersedes(XEvent *ev, XEvent *old);
 static Monitor *systraytomon(Monitor *m);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
-static void tile(Monitor *m);
+static long long timestamp(void);
 static void viewnext(const Arg *arg);
 static void viewprev(const Arg *arg);
 static void togglebar(const Arg *arg);
 static void togglefloating(const Arg *arg);
 static void toggletag(const Arg *arg);
 static void toggleview(const Arg *arg);
+static void tracebegin(Trace *t);
+static void traceend(Stat *s, const Trace *t);
 static void unfocus(Client *c, int setfocus);
 static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void updatebarpos(Monitor *m);
+static void updatebardrw(void);
 static void updatebars(void);
 static void updateclientlist(void);
+static void updateclients(Monitor *m);
 static int updategeom(void);
+static void updatemonindex(void);
+static void updatemons(void);
 static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
 static void updatestatus(void);
@@ -262,6 +480,7 @@ static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
+static int waitevents(void);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
 static Client *wintosystrayicon(Window w);
@@ -284,9 +503,11 @@ static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
+	[CirculateNotify] = circulatenotify,
 	[ClientMessage] = clientmessage,
 	[ConfigureRequest] = configurerequest,
 	[ConfigureNotify] = configurenotify,
+	[CreateNotify] = createnotify,
 	[DestroyNotify] = destroynotify,
 	[EnterNotify] = enternotify,
 	[Expose] = expose,
@@ -296,10 +517,20 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[MapRequest] = maprequest,
 	[MotionNotify] = motionnotify,
 	[PropertyNotify] = propertynotify,
+	[ReparentNotify] = reparentnotify,
 	[ResizeRequest] = resizerequest,
 	[UnmapNotify] = unmapnotify
 };
 static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast];
+static Atom stateatom;
+#ifdef XRANDR
+static int haverandr, rrevbase; /* monitors follow their CRTCs */
+#endif /* XRANDR */
+#ifdef XSYNC
+static Atom syncrequest, synccounter;
+static int havesync, syncevent, syncerror;
+#endif /* XSYNC */
+static Matcher *rulematch[3]; /* over the class, instance and title of rules */
 static int restart = 0;
 static int running = 1;
 static Cur *cursor[CurLast];
@@ -307,7 +538,33 @@ static Clr **scheme;
 static Display *dpy;
 static Drw *drw;
 static Monitor *mons, *selmon;
+static MonIndex monindex = { .dirty = 1 };
 static Window root, wmcheckwin;
+static Client *clienthash[WINHASHSIZE], *iconhash[WINHASHSIZE];
+static XEvent evbatch[EVBATCHSIZE];
+static int evbatchlen, evbatchpos;
+static Watch watches[MAXWATCHES];
+static int nwatches;
+static WinList clientlist;   /* managed windows in mapping order */
+static WinList stacking;     /* managed and bar windows, bottom to top */
+static int clientlistdirty;
+static int scanning;        /* manage() leaves arranging to scan() */
+static long *savedstate;    /* left by the dwm restarting into this one */
+static long *savedclients, *savedstack;
+static int nsaved;          /* clients in savedstate */
+static ClientSlab *slabs;
+static Client *freeclients; /* unused records of the slabs, chained by next */
+static KeyBind *keybinds;   /* of keycode k are keyfirst[k] to keyfirst[k + 1] */
+static unsigned int nkeybinds, keybindcap, keyfirst[257];
+static Timer timers[TimerLast] = {
+	[TimerStatus] = { -1, statustimer },
+	[TimerStats] = { -1, statstimer },
+	[TimerFonts] = { -1, fonttimer },
+};
+static char fontcachefile[256]; /* empty if the fallback fonts are not kept */
+static int tracing;         /* seconds between stats dumps, 0 if not tracing */
+static long long tracestart;
+static Stat evstats[LASTEvent], barstats;
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
@@ -316,27 +573,59 @@ static Window root, wmcheckwin;
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
 /* function implementations */
+/* calls func whenever fd becomes readable, returns 0 if the table is full */
+int
+addwatch(int fd, void (*func)(int fd))
+{
+	if (nwatches == LENGTH(watches))
+		return 0;
+	watches[nwatches].fd = fd;
+	watches[nwatches++].func = func;
+	return 1;
+}
+
+/* clients come from slabs, so the ones walked by a layout are close in
+ * memory, the last freed record is reused first */
+Client *
+allocclient(void)
+{
+	ClientSlab *s;
+	Client *c;
+	int i;
+
+	if (!freeclients) {
+		s = ecalloc(1, sizeof(ClientSlab));
+		s->next = slabs;
+		slabs = s;
+		for (i = CLIENTSLAB - 1; i >= 0; i--) {
+			s->clients[i].next = freeclients;
+			freeclients = &s->clients[i];
+		}
+	}
+	c = freeclients;
+	freeclients = c->next;
+	memset(c, 0, sizeof(Client));
+	return c;
+}
+
 void
-applyrules(Client *c)
+applyrules(Client *c, const char *class, const char *instance)
 {
-	const char *class, *instance;
 	unsigned int i;
+	unsigned char hit[3][LENGTH(rules)];
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
 
 	/* rule matching */
 	c->isfloating = 0;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
 
+	match_find(rulematch[0], class, hit[0]);
+	match_find(rulematch[1], instance, hit[1]);
+	match_find(rulematch[2], c->name, hit[2]);
 	for (i = 0; i < LENGTH(rules); i++) {
 		r = &rules[i];
-		if ((!r->title || strstr(c->name, r->title))
-		&& (!r->class || strstr(class, r->class))
-		&& (!r->instance || strstr(instance, r->instance)))
+		if (hit[0][i] && hit[1][i] && hit[2][i])
 		{
 			c->isfloating = r->isfloating;
 			c->tags |= r->tags;
@@ -345,10 +634,6 @@ applyrules(Client *c)
 				c->mon = m;
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
 }
 
@@ -387,6 +672,13 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 	if (resizehints || c->isfloating || !c->mon->lt[c->mon->sellt]->arrange) {
 		if (!c->hintsvalid)
 			updatesizehints(c);
+		if (*w == c->hintw && *h == c->hinth) {
+			*w = c->hintcw;
+			*h = c->hintch;
+			return *x != c->x || *y != c->y || *w != c->w || *h != c->h;
+		}
+		c->hintw = *w;
+		c->hinth = *h;
 		/* see last two sentences in ICCCM 4.1.2.3 */
 		baseismin = c->basew == c->minw && c->baseh == c->minh;
 		if (!baseismin) { /* temporarily remove base dimensions */
@@ -416,30 +708,86 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact)
 			*w = MIN(*w, c->maxw);
 		if (c->maxh)
 			*h = MIN(*h, c->maxh);
+		c->hintcw = *w;
+		c->hintch = *h;
 	}
 	return *x != c->x || *y != c->y || *w != c->w || *h != c->h;
 }
 
+/* all configure requests of an arrange are only queued by resizeclient()
+ * and reach the server together with a single XSync() at the end */
 void
 arrange(Monitor *m)
 {
-	if (m)
-		showhide(m->stack);
-	else for (m = mons; m; m = m->next)
-		showhide(m->stack);
+	/* laid out first, so that clients are shown at their new geometry */
 	if (m) {
 		arrangemon(m);
+		showhide(m->stack);
 		restack(m);
-	} else for (m = mons; m; m = m->next)
-		arrangemon(m);
+	} else {
+		for (m = mons; m; m = m->next) {
+			arrangemon(m);
+			showhide(m->stack);
+		}
+		XSync(dpy, False);
+	}
 }
 
 void
 arrangemon(Monitor *m)
 {
+	LayoutArgs a;
+	Client *c;
+	Rect *r;
+	unsigned int i;
+	int x, y, w, h, bw, in;
+
 	strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
-	if (m->lt[m->sellt]->arrange)
-		m->lt[m->sellt]->arrange(m);
+	updateclients(m);
+	if (m->lt[m->sellt]->arrange == monocle && m->nvis > 0) /* override layout symbol */
+		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", m->nvis);
+	if (!m->lt[m->sellt]->arrange || !m->ntiled)
+		return;
+
+	/* a rectangle gives up in of the gap on its top and left and the rest
+	 * on its bottom and right, the window area is inset the other way
+	 * round, so that all gaps are gappx wide, odd ones too */
+	in = gappx / 2;
+	a.area.x = m->wx + gappx - in;
+	a.area.y = m->wy + gappx - in;
+	a.area.w = m->ww - gappx;
+	a.area.h = m->wh - gappx;
+	a.n = m->ntiled;
+	a.nmaster = m->nmaster;
+	a.mfact = m->mfact;
+	m->lt[m->sellt]->arrange(&a, m->rects);
+
+	for (i = 0; i < m->ntiled; i++) {
+		c = m->tiled[i];
+		r = &m->rects[i];
+		/* a client having the area to itself has no border and gaps */
+		if (r->x == a.area.x && r->y == a.area.y
+		&& r->w == a.area.w && r->h == a.area.h) {
+			x = m->wx;
+			y = m->wy;
+			w = m->ww;
+			h = m->wh;
+			bw = 0;
+		} else {
+			x = r->x + in;
+			y = r->y + in;
+			w = r->w - gappx;
+			h = r->h - gappx;
+			bw = c->bw;
+		}
+		w = MAX(w - 2 * bw, 1);
+		h = MAX(h - 2 * bw, 1);
+		/* untouched rectangles cost no request */
+		if (!applysizehints(c, &x, &y, &w, &h, 0) && c->bare == !bw)
+			continue;
+		c->bare = !bw;
+		resizeclient(c, x, y, w, h);
+	}
 }
 
 void
@@ -447,6 +795,7 @@ attach(Client *c)
 {
 	c->next = c->mon->clients;
 	c->mon->clients = c;
+	markclients(c->mon);
 }
 
 void
@@ -458,6 +807,14 @@ attachaside(Client *c) {
 	}
 	c->next = at->next;
 	at->next = c;
+	markclients(c->mon);
+}
+
+void
+attachhash(Client **tab, Client *c)
+{
+	c->hnext = tab[WINHASH(c->win)];
+	tab[WINHASH(c->win)] = c;
 }
 
 void
@@ -520,11 +877,25 @@ checkotherwm(void)
 	XSync(dpy, False);
 }
 
+void
+circulatenotify(XEvent *e)
+{
+	XCirculateEvent *ev = &e->xcirculate;
+
+	if (ev->event != root)
+		return;
+	if (ev->place == PlaceOnTop)
+		restackwin(ev->window, None);
+	else
+		stackabove(ev->window, None);
+}
+
 void
 cleanup(void)
 {
 	Arg a = {.ui = ~0};
 	Layout foo = { "", NULL };
+	ClientSlab *s;
 	Monitor *m;
 	size_t i;
 
@@ -546,6 +917,23 @@ cleanup(void)
 	for (i = 0; i < LENGTH(colors); i++)
 		drw_scm_free(drw, scheme[i], 3);
 	free(scheme);
+	if (builtinstatus)
+		status_free();
+	ipc_cleanup();
+	for (i = 0; i < LENGTH(rulematch); i++)
+		match_free(rulematch[i]);
+	updateclientlist();
+	free(clientlist.w);
+	free(stacking.w);
+	free(keybinds);
+	free(monindex.xs);
+	free(monindex.ys);
+	free(monindex.cells);
+	while ((s = slabs)) {
+		slabs = s->next;
+		free(s);
+	}
+	freeclients = NULL;
 	XDestroyWindow(dpy, wmcheckwin);
 	drw_free(drw);
 	XSync(dpy, False);
@@ -566,6 +954,13 @@ cleanupmon(Monitor *mon)
 	}
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	listremove(&stacking, mon->barwin);
+	if (systray && systray->mon == mon)
+		systray->mon = NULL;
+	monindex.dirty = 1;
+	free(mon->vis);
+	free(mon->tiled);
+	free(mon->rects);
 	free(mon);
 }
 
@@ -580,24 +975,25 @@ clientmessage(XEvent *e)
 	if (showsystray && cme->window == systray->win && cme->message_type == netatom[NetSystemTrayOP]) {
 		/* add systray icons */
 		if (cme->data.l[1] == SYSTEM_TRAY_REQUEST_DOCK) {
-			if (!(c = (Client *)calloc(1, sizeof(Client))))
-				die("fatal: could not malloc() %u bytes\n", sizeof(Client));
+			c = allocclient();
 			if (!(c->win = cme->data.l[2])) {
-				free(c);
+				freeclient(c);
 				return;
 			}
 			c->mon = selmon;
-			c->next = systray->icons;
-			systray->icons = c;
 			if (!XGetWindowAttributes(dpy, c->win, &wa)) {
-				free(c);
+				freeclient(c);
 				return;
 			}
+			c->next = systray->icons;
+			systray->icons = c;
+			attachhash(iconhash, c);
 			c->x = c->oldx = c->y = c->oldy = 0;
 			c->w = c->oldw = wa.width;
 			c->h = c->oldh = wa.height;
 			c->oldbw = wa.border_width;
 			c->bw = 0;
+			c->sx = -1; /* placed by updatesystray() */
 			c->isfloating = True;
 			updatesizehints(c);
 			updatesystrayicongeom(c, wa.width, wa.height);
@@ -612,9 +1008,6 @@ clientmessage(XEvent *e)
 			sendevent(c->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_FOCUS_IN, 0 , systray->win, XEMBED_EMBEDDED_VERSION);
 			sendevent(c->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_WINDOW_ACTIVATE, 0 , systray->win, XEMBED_EMBEDDED_VERSION);
 			sendevent(c->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_MODALITY_ON, 0 , systray->win, XEMBED_EMBEDDED_VERSION);
-			XSync(dpy, False);
-			resizebarwin(selmon);
-			updatesystray();
 			setclientstate(c, NormalState);
 		}
 		return;
@@ -633,6 +1026,23 @@ clientmessage(XEvent *e)
 	}
 }
 
+/* applyrules() finds the rules matching a window in one pass over each of
+ * its strings, instead of searching them for every rule */
+void
+compilerules(void)
+{
+	const char *pats[3][LENGTH(rules)];
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(rules); i++) {
+		pats[0][i] = rules[i].class;
+		pats[1][i] = rules[i].instance;
+		pats[2][i] = rules[i].title;
+	}
+	for (i = 0; i < LENGTH(rulematch); i++)
+		rulematch[i] = match_new(pats[i], LENGTH(rules));
+}
+
 void
 configure(Client *c)
 {
@@ -655,28 +1065,25 @@ configure(Client *c)
 void
 configurenotify(XEvent *e)
 {
-	Monitor *m;
-	Client *c;
 	XConfigureEvent *ev = &e->xconfigure;
 	int dirty;
 
-	/* TODO: updategeom handling sucks, needs to be simplified */
-	if (ev->window == root) {
+	/* restacking by anyone, including override-redirect windows */
+	if (ev->event == root && ev->window != root)
+		stackabove(ev->window, ev->above);
+	else if (ev->window == root) {
 		dirty = (sw != ev->width || sh != ev->height);
 		sw = ev->width;
 		sh = ev->height;
-		if (updategeom() || dirty) {
-			drw_resize(drw, sw, bh);
-			updatebars();
-			for (m = mons; m; m = m->next) {
-				for (c = m->clients; c; c = c->next)
-					if (c->isfullscreen)
-						resizeclient(c, m->mx, m->my, m->mw, m->mh);
-				resizebarwin(m);
-			}
-			focus(NULL);
-			arrange(NULL);
+#ifdef XRANDR
+		if (haverandr) { /* the monitors follow rrnotify() */
+			if (dirty)
+				updatemons();
+			return;
 		}
+#endif /* XRANDR */
+		if (updategeom() || dirty)
+			updatemons();
 	}
 }
 
@@ -715,8 +1122,11 @@ configurerequest(XEvent *e)
 				c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
 			if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight)))
 				configure(c);
-			if (ISVISIBLE(c))
+			if (ISVISIBLE(c) || c->hidden) {
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+				c->sx = c->x;
+				c->sy = c->y;
+			}
 		} else
 			configure(c);
 	} else {
@@ -746,6 +1156,7 @@ createmon(void)
 	m->lt[0] = &layouts[0];
 	m->lt[1] = &layouts[1 % LENGTH(layouts)];
 	strncpy(m->ltsymbol, layouts[0].symbol, sizeof m->ltsymbol);
+	monindex.dirty = 1;
 	return m;
 }
 
@@ -765,6 +1176,31 @@ systraytomon(Monitor *m) {
 	return t;
 }
 
+/* new windows are created on top of their siblings */
+void
+createnotify(XEvent *e)
+{
+	XCreateWindowEvent *ev = &e->xcreatewindow;
+
+	if (ev->parent != root)
+		return;
+	/* a reused id may still be known from a window that left the root */
+	listremove(&stacking, ev->window);
+	listinsert(&stacking, stacking.n, ev->window);
+}
+
+void
+delwatch(int fd)
+{
+	int i;
+
+	for (i = 0; i < nwatches; i++)
+		if (watches[i].fd == fd) {
+			watches[i] = watches[--nwatches];
+			return;
+		}
+}
+
 void
 destroynotify(XEvent *e)
 {
@@ -773,11 +1209,10 @@ destroynotify(XEvent *e)
 
 	if ((c = wintoclient(ev->window)))
 		unmanage(c, 1);
-	else if ((c = wintosystrayicon(ev->window))) {
+	else if ((c = wintosystrayicon(ev->window)))
 		removesystrayicon(c);
-		resizebarwin(selmon);
-		updatesystray();
-	}
+	else
+		listremove(&stacking, ev->window);
 }
 
 void
@@ -787,6 +1222,17 @@ detach(Client *c)
 
 	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next);
 	*tc = c->next;
+	markclients(c->mon);
+}
+
+void
+detachhash(Client **tab, Client *c)
+{
+	Client **tc;
+
+	for (tc = &tab[WINHASH(c->win)]; *tc && *tc != c; tc = &(*tc)->hnext);
+	if (*tc)
+		*tc = c->hnext;
 }
 
 void
@@ -803,6 +1249,17 @@ detachstack(Client *c)
 	}
 }
 
+/* drop the not yet dispatched events of a type from the current batch */
+void
+discardevents(int type)
+{
+	int i;
+
+	for (i = evbatchpos + 1; i < evbatchlen; i++)
+		if (evbatch[i].type == type)
+			evbatch[i].type = 0;
+}
+
 Monitor *
 dirtomon(int dir)
 {
@@ -818,71 +1275,362 @@ dirtomon(int dir)
 	return m;
 }
 
+/* starts dragging c, the pointer must be grabbed already */
+void
+dragbegin(Drag *d, Client *c)
+{
+	XGCValues gv;
+#ifdef XSYNC
+	XSyncAlarmAttributes aa;
+	Atom *protocols, real;
+	unsigned char *p = NULL;
+	unsigned long n, extra;
+	int format, i, exists = 0;
+#endif /* XSYNC */
+
+	memset(d, 0, sizeof(*d));
+	d->c = c;
+	d->x = c->x;
+	d->y = c->y;
+	d->w = c->w;
+	d->h = c->h;
+	if ((d->outline = dragoutline)) {
+		gv.function = GXinvert;
+		gv.subwindow_mode = IncludeInferiors;
+		gv.line_width = MAX(borderpx, 1);
+		d->gc = XCreateGC(dpy, root, GCFunction|GCSubwindowMode|GCLineWidth, &gv);
+		XGrabServer(dpy);
+		return;
+	}
+#ifdef XSYNC
+	/* _NET_WM_SYNC_REQUEST lets the client say when it has repainted */
+	d->counter = None;
+	if (!havesync || !XGetWMProtocols(dpy, c->win, &protocols, &i))
+		return;
+	while (!exists && i--)
+		exists = protocols[i] == syncrequest;
+	XFree(protocols);
+	if (exists && XGetWindowProperty(dpy, c->win, synccounter, 0L, 1L, False, XA_CARDINAL,
+		&real, &format, &n, &extra, &p) == Success && p) {
+		if (format == 32 && n == 1)
+			d->counter = *(long *)p;
+		XFree(p);
+	}
+	if (d->counter != None && !XSyncQueryCounter(dpy, d->counter, &d->value))
+		d->counter = None;
+	if (d->counter != None) {
+		aa.trigger.counter = d->counter;
+		aa.trigger.value_type = XSyncAbsolute;
+		aa.trigger.wait_value = d->value;
+		aa.trigger.test_type = XSyncPositiveComparison;
+		aa.events = True;
+		d->alarm = XSyncCreateAlarm(dpy, XSyncCACounter|XSyncCAValueType
+			|XSyncCAValue|XSyncCATestType|XSyncCAEvents, &aa);
+	}
+#endif /* XSYNC */
+}
+
+/* applies the last geometry asked for, an outline drag resizes only here */
+void
+dragend(Drag *d)
+{
+	if (d->outline) {
+		drawoutline(d, 0);
+		XFreeGC(dpy, d->gc);
+		XUngrabServer(dpy);
+	}
+	if (d->pending)
+		resize(d->c, d->x, d->y, d->w, d->h, 1);
+	d->pending = 0;
+#ifdef XSYNC
+	if (d->counter != None)
+		XSyncDestroyAlarm(dpy, d->alarm);
+#endif /* XSYNC */
+}
+
+/* waits for the next event in mask, in between the geometry asked for is
+ * applied once the client is ready for it */
+void
+dragevent(Drag *d, XEvent *ev, long mask)
+{
+	struct pollfd pfd = { ConnectionNumber(dpy), POLLIN, 0 };
+	Client *c = d->c;
+	int timeout;
+
+	for (;;) {
+		if (d->pending && !d->outline && dragready(d)) {
+#ifdef XSYNC
+			if (d->counter != None && (d->w != c->w || d->h != c->h))
+				dragsync(d);
+#endif /* XSYNC */
+			resize(c, d->x, d->y, d->w, d->h, 1);
+			d->pending = 0;
+			d->last = timestamp();
+		}
+		if (!d->pending || d->outline) {
+			XMaskEvent(dpy, mask, ev);
+			return;
+		}
+		if (XCheckMaskEvent(dpy, mask, ev))
+			return;
+		timeout = 1000 / refreshrate;
+#ifdef XSYNC
+		if (!d->waiting)
+#endif /* XSYNC */
+			timeout = MAX(timeout - (int)(timestamp() - d->last), 1);
+		poll(&pfd, 1, timeout);
+	}
+}
+
+/* the next geometry is sent once the client repainted after the last one,
+ * or not sooner than refreshrate allows if it cannot tell */
+int
+dragready(Drag *d)
+{
+#ifdef XSYNC
+	XEvent ev;
+	XSyncAlarmNotifyEvent *ae = (XSyncAlarmNotifyEvent *)&ev;
+
+	if (d->waiting) {
+		while (XCheckTypedEvent(dpy, syncevent + XSyncAlarmNotify, &ev))
+			if (ae->alarm == d->alarm && !XSyncValueLessThan(ae->counter_value, d->value))
+				d->waiting = 0;
+		if (d->waiting && timestamp() - d->last < synctimeout)
+			return 0;
+		d->waiting = 0;
+		return 1;
+	}
+#endif /* XSYNC */
+	return timestamp() - d->last >= 1000 / refreshrate;
+}
+
+#ifdef XSYNC
+/* asks the client to ack the repaint after the next resize, the alarm
+ * reports it without polling the counter */
+void
+dragsync(Drag *d)
+{
+	XSyncAlarmAttributes aa;
+	XEvent ev;
+	int overflow;
+
+	XSyncIntToValue(&aa.trigger.wait_value, 1);
+	XSyncValueAdd(&d->value, d->value, aa.trigger.wait_value, &overflow);
+	aa.trigger.wait_value = d->value;
+	XSyncChangeAlarm(dpy, d->alarm, XSyncCAValue, &aa);
+	/* dragbegin() found the protocol in WM_PROTOCOLS already */
+	ev.type = ClientMessage;
+	ev.xclient.window = d->c->win;
+	ev.xclient.message_type = wmatom[WMProtocols];
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = syncrequest;
+	ev.xclient.data.l[1] = CurrentTime;
+	ev.xclient.data.l[2] = XSyncValueLow32(d->value);
+	ev.xclient.data.l[3] = XSyncValueHigh32(d->value);
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, d->c->win, False, NoEventMask, &ev);
+	d->waiting = 1;
+}
+#endif /* XSYNC */
+
+/* asks for a new geometry, superseding the pending one */
+void
+dragto(Drag *d, int x, int y, int w, int h)
+{
+	if (d->outline)
+		drawoutline(d, 0);
+	d->x = x;
+	d->y = y;
+	d->w = w;
+	d->h = h;
+	d->pending = 1;
+	if (d->outline) {
+		applysizehints(d->c, &d->x, &d->y, &d->w, &d->h, 1);
+		drawoutline(d, 1);
+	}
+}
+
 void
 drawbar(Monitor *m)
 {
 	int x, w, tw = 0, stw = 0;
 	int boxs = drw->fonts->h / 9;
 	int boxw = drw->fonts->h / 6 + 2;
-	unsigned int i, occ = 0, urg = 0;
-	Client *c;
+	unsigned int i, j, n, ndirty, changed, occ, urg;
+	int dirty[BARSEGS];
+	BarSeg *seg = m->barsegs;
 
+	m->bardirty = 0;
 	if (!m->showbar)
 		return;
 
 	if(showsystray && m == systraytomon(m) && !systrayonleft)
 		stw = getsystraywidth();
 
-	/* draw status first so it can be overdrawn by tags later */
+	resizebarwin(m);
+
+	/* segments: status, tags, layout symbol, title */
+	n = LENGTH(tags) + 3;
 	if (m == selmon) { /* status is only drawn on selected monitor */
-		drw_setscheme(drw, scheme[SchemeNorm]);
 		tw = TEXTW(stext) - lrpad / 2 + 2; /* 2px right padding */
-		drw_text(drw, m->ww - tw - stw - 2 * sp, 0, tw, bh, lrpad / 2 - 2, stext, 0);
+		dirty[0] = setbarseg(&seg[0], m->ww - tw - stw - 2 * sp, tw, stext, 0);
+	} else
+		dirty[0] = setbarseg(&seg[0], 0, 0, NULL, 0);
+	updateclients(m);
+	occ = m->occ;
+	urg = m->urg;
+	x = 0;
+	for (i = 0; i < LENGTH(tags); i++) {
+		w = TEXTW(tags[i]);
+		dirty[i + 1] = setbarseg(&seg[i + 1], x, w, tags[i],
+			(m->tagset[m->seltags] & 1 << i ? 1 : 0) | (urg & 1 << i ? 2 : 0)
+			| (occ & 1 << i ? 4 : 0)
+			| (m == selmon && selmon->sel && selmon->sel->tags & 1 << i ? 8 : 0));
+		x += w;
 	}
+	w = TEXTW(m->ltsymbol);
+	dirty[n - 2] = setbarseg(&seg[n - 2], x, w, m->ltsymbol, 0);
+	x += w;
+	if ((w = m->ww - tw - stw - x) <= bh)
+		dirty[n - 1] = setbarseg(&seg[n - 1], x, 0, NULL, 0);
+	else if (m->sel)
+		dirty[n - 1] = setbarseg(&seg[n - 1], x, w - 2 * sp, m->sel->name,
+			1 | (m == selmon ? 2 : 0) | (m->sel->isfloating ? 4 : 0) | (m->sel->isfixed ? 8 : 0));
+	else
+		dirty[n - 1] = setbarseg(&seg[n - 1], x, w - 2 * sp, NULL, 0);
 
-	resizebarwin(m);
+	/* only segments that changed since the last draw are repainted, plus
+	 * the ones they overlap, since the status may be overdrawn by tags */
+	do {
+		changed = 0;
+		for (i = 0; i < n; i++)
+			for (j = 0; j < n; j++)
+				if (dirty[i] && !dirty[j] && seg[i].w > 0 && seg[j].w > 0
+				&& seg[i].x < seg[j].x + seg[j].w && seg[j].x < seg[i].x + seg[i].w)
+					dirty[j] = changed = 1;
+	} while (changed);
 
-	for (c = m->clients; c; c = c->next) {
-		occ |= c->tags;
-		if (c->isurgent)
-			urg |= c->tags;
+	/* draw status first so it can be overdrawn by tags later */
+	if (dirty[0] && seg[0].w > 0) {
+		drw_setscheme(drw, scheme[SchemeNorm]);
+		drw_text(drw, seg[0].x, 0, tw, bh, lrpad / 2 - 2, stext, 0);
 	}
-	x = 0;
 	for (i = 0; i < LENGTH(tags); i++) {
-		w = TEXTW(tags[i]);
+		if (!dirty[i + 1])
+			continue;
+		x = seg[i + 1].x;
 		drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]);
-		drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
+		drw_text(drw, x, 0, seg[i + 1].w, bh, lrpad / 2, tags[i], urg & 1 << i);
 		if (occ & 1 << i)
 			drw_rect(drw, x + boxs, boxs, boxw, boxw,
 				m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
 				urg & 1 << i);
-		x += w;
 	}
-	w = TEXTW(m->ltsymbol);
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
-
-	if ((w = m->ww - tw - stw - x) > bh) {
+	if (dirty[n - 2]) {
+		drw_setscheme(drw, scheme[SchemeNorm]);
+		drw_text(drw, seg[n - 2].x, 0, seg[n - 2].w, bh, lrpad / 2, m->ltsymbol, 0);
+	}
+	if (dirty[n - 1] && seg[n - 1].w > 0) {
+		x = seg[n - 1].x;
 		if (m->sel) {
 			drw_setscheme(drw, scheme[m == selmon ? SchemeSel : SchemeNorm]);
-			drw_text(drw, x, 0, w - 2 * sp, bh, lrpad / 2, m->sel->name, 0);
+			drw_text(drw, x, 0, seg[n - 1].w, bh, lrpad / 2, m->sel->name, 0);
 			if (m->sel->isfloating)
 				drw_rect(drw, x + boxs, boxs, boxw, boxw, m->sel->isfixed, 0);
 		} else {
 			drw_setscheme(drw, scheme[SchemeNorm]);
-			drw_rect(drw, x, 0, w - 2 * sp, bh, 1, 1);
+			drw_rect(drw, x, 0, seg[n - 1].w, bh, 1, 1);
 		}
 	}
-	drw_map(drw, m->barwin, 0, 0, m->ww - stw, bh);
+
+	for (i = ndirty = 0; i < n; i++)
+		ndirty += dirty[i];
+	if (ndirty == n)
+		drw_map(drw, m->barwin, 0, 0, m->ww - stw, bh);
+	else for (i = 0; i < n; i++)
+		if (dirty[i] && seg[i].w > 0)
+			drw_map(drw, m->barwin, seg[i].x, 0, seg[i].w, bh);
 }
 
 void
 drawbars(void)
 {
+	static Monitor *barsel; /* only compared, may be gone */
 	Monitor *m;
-
+	Trace t;
+
+	/* the status and selection are drawn on the bar of the selected monitor */
+	if (selmon != barsel) {
+		for (m = mons; m; m = m->next)
+			if (m == barsel || m == selmon)
+				m->bardirty = 1;
+		barsel = selmon;
+	}
 	for (m = mons; m; m = m->next)
-		drawbar(m);
+		if (m->bardirty) {
+			if (tracing)
+				tracebegin(&t);
+			drawbar(m);
+			if (tracing)
+				traceend(&barstats, &t);
+		}
+	if (drw_fontset_pending(drw) && timers[TimerFonts].due < 0)
+		settimer(TimerFonts, 0);
+}
+
+void
+drawoutline(Drag *d, int show)
+{
+	if (!d->outline || d->drawn == show)
+		return;
+	XDrawRectangle(dpy, root, d->gc, d->x, d->y,
+		d->w + 2 * d->c->bw - 1, d->h + 2 * d->c->bw - 1);
+	d->drawn = show;
+}
+
+/* prints the statistics recorded since the last dump on stderr and
+ * starts over */
+void
+dumpstats(void)
+{
+	static const char *names[LASTEvent] = {
+		[ButtonPress] = "ButtonPress",
+		[CirculateNotify] = "CirculateNotify",
+		[ClientMessage] = "ClientMessage",
+		[ConfigureRequest] = "ConfigureRequest",
+		[ConfigureNotify] = "ConfigureNotify",
+		[CreateNotify] = "CreateNotify",
+		[DestroyNotify] = "DestroyNotify",
+		[EnterNotify] = "EnterNotify",
+		[Expose] = "Expose",
+		[FocusIn] = "FocusIn",
+		[KeyPress] = "KeyPress",
+		[MappingNotify] = "MappingNotify",
+		[MapRequest] = "MapRequest",
+		[MotionNotify] = "MotionNotify",
+		[PropertyNotify] = "PropertyNotify",
+		[ReparentNotify] = "ReparentNotify",
+		[ResizeRequest] = "ResizeRequest",
+		[UnmapNotify] = "UnmapNotify"
+	};
+	Stat *s;
+	int i;
+
+	fprintf(stderr, "dwm: stats over %lld ms\n%-16s %8s %10s %10s %8s %8s\n",
+		timestamp() - tracestart, "handler", "count", "avg us", "max us",
+		"reqs/ev", "syncs/ev");
+	for (i = 0; i <= LASTEvent; i++) {
+		s = i < LASTEvent ? &evstats[i] : &barstats;
+		if (!s->count)
+			continue;
+		fprintf(stderr, "%-16s %8lu %10.1f %10.1f %8.2f %8.2f\n",
+			i == LASTEvent ? "drawbar" : names[i] ? names[i] : "unknown", s->count,
+			s->ns / 1e3 / s->count, s->maxns / 1e3,
+			(double)s->reqs / s->count, (double)s->syncs / s->count);
+	}
+	memset(evstats, 0, sizeof evstats);
+	memset(&barstats, 0, sizeof barstats);
+	tracestart = timestamp();
 }
 
 void
@@ -904,6 +1652,27 @@ enternotify(XEvent *e)
 	focus(c);
 }
 
+/* the window an event is about, xany.window of the structure events is the
+ * parent or the window the event was selected on */
+Window
+evwindow(XEvent *ev)
+{
+	switch (ev->type) {
+	case CirculateNotify: return ev->xcirculate.window;
+	case CirculateRequest: return ev->xcirculaterequest.window;
+	case ConfigureNotify: return ev->xconfigure.window;
+	case ConfigureRequest: return ev->xconfigurerequest.window;
+	case CreateNotify: return ev->xcreatewindow.window;
+	case DestroyNotify: return ev->xdestroywindow.window;
+	case GravityNotify: return ev->xgravity.window;
+	case MapNotify: return ev->xmap.window;
+	case MapRequest: return ev->xmaprequest.window;
+	case ReparentNotify: return ev->xreparent.window;
+	case UnmapNotify: return ev->xunmap.window;
+	}
+	return ev->xany.window;
+}
+
 void
 expose(XEvent *e)
 {
@@ -911,35 +1680,198 @@ expose(XEvent *e)
 	XExposeEvent *ev = &e->xexpose;
 
 	if (ev->count == 0 && (m = wintomon(ev->window))) {
-		drawbar(m);
-		if (m == selmon)
-			updatesystray();
+		memset(m->barsegs, 0, sizeof m->barsegs); /* repaint every segment */
+		markbar(m);
 	}
 }
 
-void
-focus(Client *c)
+#ifdef XCB
+enum { PropName, PropWMName, PropTrans, PropClass, PropState, PropType,
+       PropNormal, PropHints, PropLast }; /* properties read by fetchprops() */
+
+static void
+requestprops(xcb_connection_t *xc, Window w, xcb_get_property_cookie_t *ck)
 {
-	if (!c || !ISVISIBLE(c))
-		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
-	if (selmon->sel && selmon->sel != c)
-		unfocus(selmon->sel, 0);
-	if (c) {
-		if (c->mon != selmon)
-			selmon = c->mon;
-		if (c->isurgent)
-			seturgent(c, 0);
-		detachstack(c);
-		attachstack(c);
-		grabbuttons(c, 1);
-		XSetWindowBorder(dpy, c->win, scheme[SchemeSel][ColBorder].pixel);
-		setfocus(c);
-	} else {
-		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+	const Atom prop[PropLast] = { netatom[NetWMName], XA_WM_NAME, XA_WM_TRANSIENT_FOR,
+		XA_WM_CLASS, netatom[NetWMState], netatom[NetWMWindowType],
+		XA_WM_NORMAL_HINTS, XA_WM_HINTS };
+	const Atom type[PropLast] = { XCB_GET_PROPERTY_TYPE_ANY, XCB_GET_PROPERTY_TYPE_ANY,
+		XA_WINDOW, XA_STRING, XA_ATOM, XA_ATOM, XA_WM_SIZE_HINTS, XA_WM_HINTS };
+	const uint32_t len[PropLast] = { 64, 64, 1, 128, 1, 1, 18, 9 }; /* in 32-bit units */
+	int i;
+
+	for (i = 0; i < PropLast; i++)
+		ck[i] = xcb_get_property(xc, 0, w, prop[i], type[i], 0, len[i]);
+}
+
+/* the pre-ICCCM 1 version lacks base size and gravity */
+static void
+readsizehints(xcb_get_property_reply_t *rep, XSizeHints *size)
+{
+	uint32_t v[18];
+	int n = xcb_get_property_value_length(rep);
+
+	if (rep->format != 32 || n < 15 * 4)
+		return;
+	memcpy(v, xcb_get_property_value(rep), MIN(n, (int)sizeof(v)));
+	size->flags = v[0];
+	if (n < 18 * 4)
+		size->flags &= ~(PBaseSize|PWinGravity);
+	size->min_width = v[5];
+	size->min_height = v[6];
+	size->max_width = v[7];
+	size->max_height = v[8];
+	size->width_inc = v[9];
+	size->height_inc = v[10];
+	size->min_aspect.x = v[11];
+	size->min_aspect.y = v[12];
+	size->max_aspect.x = v[13];
+	size->max_aspect.y = v[14];
+	if (n >= 18 * 4) {
+		size->base_width = v[15];
+		size->base_height = v[16];
+		size->win_gravity = v[17];
+	}
+}
+
+static void
+readprops(xcb_connection_t *xc, Window w, xcb_get_property_cookie_t *ck, WinProps *p)
+{
+	xcb_get_property_reply_t *rep;
+	uint32_t v[18];
+	char *data;
+	int i, l, n;
+
+	memset(p, 0, sizeof(*p));
+	p->size.flags = PSize;
+	strcpy(p->class, broken);
+	strcpy(p->instance, broken);
+	for (i = 0; i < PropLast; i++) {
+		if (!(rep = xcb_get_property_reply(xc, ck[i], NULL)))
+			continue;
+		data = xcb_get_property_value(rep);
+		n = xcb_get_property_value_length(rep);
+		if (rep->format == 32)
+			memcpy(v, data, MIN(n, (int)sizeof(v)));
+		switch (i) {
+		case PropName:
+		case PropWMName:
+			if (p->name[0] || rep->format != 8 || !n)
+				break;
+			/* only compound text needs Xlib to be converted */
+			if (i == PropName || rep->type == XA_STRING) {
+				n = MIN(n, (int)sizeof(p->name) - 1);
+				memcpy(p->name, data, n);
+				p->name[n] = '\0';
+			} else
+				gettextprop(w, XA_WM_NAME, p->name, sizeof p->name);
+			break;
+		case PropTrans:
+			if (rep->format == 32 && n >= 4)
+				p->trans = v[0];
+			break;
+		case PropClass: /* instance and class, both NUL terminated */
+			if (rep->format != 8)
+				break;
+			/* measured in the reply, p->instance may be truncated */
+			l = MIN(n, (int)strnlen(data, n) + 1);
+			snprintf(p->instance, sizeof(p->instance), "%.*s", l, data);
+			snprintf(p->class, sizeof(p->class), "%.*s", n - l, data + l);
+			break;
+		case PropState:
+		case PropType:
+			if (rep->format == 32 && n >= 4)
+				*(i == PropState ? &p->state : &p->wtype) = v[0];
+			break;
+		case PropNormal:
+			readsizehints(rep, &p->size);
+			break;
+		case PropHints:
+			if (rep->format != 32 || n < 8 * 4)
+				break;
+			p->wmh.flags = v[0];
+			p->wmh.input = v[1];
+			p->wmh.initial_state = v[2];
+			p->wmh.icon_pixmap = v[3];
+			p->wmh.icon_window = v[4];
+			p->wmh.icon_x = v[5];
+			p->wmh.icon_y = v[6];
+			p->wmh.icon_mask = v[7];
+			p->wmh.window_group = n >= 9 * 4 ? v[8] : 0;
+			break;
+		}
+		free(rep);
+	}
+	if (p->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(p->name, broken);
+}
+
+/* reads the title of w and the properties manage() needs with one round
+ * trip, the requests are all sent before waiting for the first reply */
+void
+fetchprops(Window w, WinProps *p)
+{
+	xcb_connection_t *xc = XGetXCBConnection(dpy);
+	xcb_get_property_cookie_t ck[PropLast];
+
+	requestprops(xc, w, ck);
+	readprops(xc, w, ck, p);
+}
+#else
+void
+fetchprops(Window w, WinProps *p)
+{
+	XClassHint ch = { NULL, NULL };
+	XWMHints *wmh;
+	long msize;
+
+	memset(p, 0, sizeof(*p));
+	if (!gettextprop(w, netatom[NetWMName], p->name, sizeof p->name))
+		gettextprop(w, XA_WM_NAME, p->name, sizeof p->name);
+	if (p->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(p->name, broken);
+	XGetTransientForHint(dpy, w, &p->trans);
+	XGetClassHint(dpy, w, &ch);
+	snprintf(p->class, sizeof(p->class), "%s", ch.res_class ? ch.res_class : broken);
+	snprintf(p->instance, sizeof(p->instance), "%s", ch.res_name ? ch.res_name : broken);
+	if (ch.res_class)
+		XFree(ch.res_class);
+	if (ch.res_name)
+		XFree(ch.res_name);
+	p->state = getatomprop(w, netatom[NetWMState]);
+	p->wtype = getatomprop(w, netatom[NetWMWindowType]);
+	if (!XGetWMNormalHints(dpy, w, &p->size, &msize))
+		p->size.flags = PSize;
+	if ((wmh = XGetWMHints(dpy, w))) {
+		p->wmh = *wmh;
+		XFree(wmh);
+	}
+}
+#endif /* XCB */
+
+void
+focus(Client *c)
+{
+	if (!c || !ISVISIBLE(c))
+		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
+	if (selmon->sel && selmon->sel != c)
+		unfocus(selmon->sel, 0);
+	if (c) {
+		if (c->mon != selmon)
+			selmon = c->mon;
+		if (c->isurgent)
+			seturgent(c, 0);
+		detachstack(c);
+		attachstack(c);
+		grabbuttons(c, 1);
+		XSetWindowBorder(dpy, c->win, scheme[SchemeSel][ColBorder].pixel);
+		setfocus(c);
+	} else {
+		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
+		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
 	selmon->sel = c;
-	drawbars();
+	markbar(selmon);
 }
 
 /* there are some broken focus acquiring clients needing extra handling */
@@ -969,34 +1901,44 @@ focusmon(const Arg *arg)
 void
 focusstack(const Arg *arg)
 {
-	Client *c = NULL, *i;
+	Client *c;
 
 	if (!selmon->sel || (selmon->sel->isfullscreen && lockfullscreen))
 		return;
-	if (arg->i > 0) {
-		for (c = selmon->sel->next; c && !ISVISIBLE(c); c = c->next);
-		if (!c)
-			for (c = selmon->clients; c && !ISVISIBLE(c); c = c->next);
-	} else {
-		for (i = selmon->clients; i != selmon->sel; i = i->next)
-			if (ISVISIBLE(i))
-				c = i;
-		if (!c)
-			for (; i; i = i->next)
-				if (ISVISIBLE(i))
-					c = i;
-	}
-	if (c) {
+	if ((c = nextvisible(selmon, selmon->sel, arg->i, 0))) {
 		focus(c);
 		restack(selmon);
 	}
 }
 
+/* looks up one fallback font per main loop iteration, so events are not
+ * held up by a series of font matches */
+void
+fonttimer(void)
+{
+	Monitor *m;
+
+	if (drw_fontset_resolve(drw))
+		for (m = mons; m; m = m->next) {
+			memset(m->barsegs, 0, sizeof m->barsegs); /* repaint every segment */
+			markbar(m);
+		}
+	if (drw_fontset_pending(drw))
+		settimer(TimerFonts, 0);
+}
+
+void
+freeclient(Client *c)
+{
+	c->next = freeclients;
+	freeclients = c;
+}
+
 Atom
-getatomprop(Client *c, Atom prop)
+getatomprop(Window w, Atom prop)
 {
 	int di;
-	unsigned long dl;
+	unsigned long dl, after;
 	unsigned char *p = NULL;
 	Atom da, atom = None;
 	/* FIXME getatomprop should return the number of items and a pointer to
@@ -1005,8 +1947,8 @@ getatomprop(Client *c, Atom prop)
 	if (prop == xatom[XembedInfo])
 		req = xatom[XembedInfo];
 
-	if (XGetWindowProperty(dpy, c->win, prop, 0L, sizeof atom, False, req,
-		&da, &di, &dl, &dl, &p) == Success && p) {
+	if (XGetWindowProperty(dpy, w, prop, 0L, sizeof atom, False, req,
+		&da, &di, &dl, &after, &p) == Success && p) {
 		atom = *(Atom *)p;
 		if (da == xatom[XembedInfo] && dl == 2)
 			atom = ((Atom *)p)[1];
@@ -1025,6 +1967,7 @@ getrootptr(int *x, int *y)
 	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
+#ifndef XCB
 long
 getstate(Window w)
 {
@@ -1042,15 +1985,12 @@ getstate(Window w)
 	XFree(p);
 	return result;
 }
+#endif /* XCB */
 
 static unsigned int
 getsystraywidth(void)
 {
-	unsigned int w = 0;
-	Client *i;
-	if(showsystray)
-		for(i = systray->icons; i; w += i->w + systrayspacing, i = i->next) ;
-	return w ? w + systrayspacing : 1;
+	return showsystray && systray && systray->w ? systray->w + systrayspacing : 1;
 }
 
 int
@@ -1097,32 +2037,61 @@ grabbuttons(Client *c, int focused)
 	}
 }
 
+/* grabs the keycodes bound in keys and indexes their bindings for
+ * keypress(), keycodes are found by a binary search of the keys sorted by
+ * keysym, each (keycode, modifiers) pair is grabbed once */
 void
 grabkeys(void)
 {
+	unsigned int i, j, k, lo, hi, mod;
+	unsigned int modifiers[4];
+	const Key *sorted[LENGTH(keys)];
+	int start, end, skip;
+	KeySym *syms, sym;
+
 	updatenumlockmask();
-	{
-		unsigned int i, j, k;
-		unsigned int modifiers[] = { 0, LockMask, numlockmask, numlockmask|LockMask };
-		int start, end, skip;
-		KeySym *syms;
+	modifiers[0] = 0;
+	modifiers[1] = LockMask;
+	modifiers[2] = numlockmask;
+	modifiers[3] = numlockmask|LockMask;
+	for (i = 0; i < LENGTH(keys); i++)
+		sorted[i] = &keys[i];
+	qsort(sorted, LENGTH(keys), sizeof(Key *), keycmp);
 
-		XUngrabKey(dpy, AnyKey, AnyModifier, root);
-		XDisplayKeycodes(dpy, &start, &end);
-		syms = XGetKeyboardMapping(dpy, start, end - start + 1, &skip);
-		if (!syms)
-			return;
-		for (k = start; k <= end; k++)
-			for (i = 0; i < LENGTH(keys); i++)
-				/* skip modifier codes, we do that ourselves */
-				if (keys[i].keysym == syms[(k - start) * skip])
-					for (j = 0; j < LENGTH(modifiers); j++)
-						XGrabKey(dpy, k,
-							 keys[i].mod | modifiers[j],
-							 root, True,
-							 GrabModeAsync, GrabModeAsync);
-		XFree(syms);
+	XUngrabKey(dpy, AnyKey, AnyModifier, root);
+	memset(keyfirst, 0, sizeof keyfirst);
+	nkeybinds = 0;
+	XDisplayKeycodes(dpy, &start, &end);
+	syms = XGetKeyboardMapping(dpy, start, end - start + 1, &skip);
+	if (!syms)
+		return;
+	for (k = start; k <= (unsigned int)end; k++) {
+		keyfirst[k] = nkeybinds;
+		sym = syms[(k - start) * skip];
+		for (lo = 0, hi = LENGTH(keys); lo < hi;)
+			if (sorted[(lo + hi) / 2]->keysym < sym)
+				lo = (lo + hi) / 2 + 1;
+			else
+				hi = (lo + hi) / 2;
+		for (; lo < LENGTH(keys) && sorted[lo]->keysym == sym; lo++) {
+			mod = CLEANMASK(sorted[lo]->mod);
+			for (i = keyfirst[k]; i < nkeybinds && keybinds[i].mod != mod; i++);
+			if (i == nkeybinds)
+				for (j = 0; j < LENGTH(modifiers); j++)
+					XGrabKey(dpy, k, mod | modifiers[j], root, True,
+						GrabModeAsync, GrabModeAsync);
+			if (nkeybinds == keybindcap) {
+				keybindcap = keybindcap ? keybindcap * 2 : LENGTH(keys);
+				if (!(keybinds = realloc(keybinds, keybindcap * sizeof(KeyBind))))
+					die("realloc:");
+			}
+			keybinds[nkeybinds].mod = mod;
+			keybinds[nkeybinds++].key = sorted[lo];
+		}
 	}
+	for (; k < LENGTH(keyfirst); k++)
+		keyfirst[k] = nkeybinds;
+	XFree(syms);
 }
 
 void
@@ -1132,6 +2101,114 @@ incnmaster(const Arg *arg)
 	arrange(selmon);
 }
 
+#ifdef XRANDR
+/* ties the monitors to the CRTCs showing them, so they can follow CRTC
+ * changes one at a time instead of rescanning all screens */
+void
+initrandr(void)
+{
+	XRRScreenResources *res;
+	XRRCrtcInfo *ci;
+	Monitor *m;
+	int i, major, minor, rrerrbase;
+
+	if (!XRRQueryExtension(dpy, &rrevbase, &rrerrbase)
+	|| !XRRQueryVersion(dpy, &major, &minor) || major < 1 || (major == 1 && minor < 2)
+	|| !(res = XRRGetScreenResourcesCurrent(dpy, root)))
+		return;
+	for (i = 0; i < res->ncrtc; i++) {
+		if (!(ci = XRRGetCrtcInfo(dpy, res, res->crtcs[i])))
+			continue;
+		for (m = mons; ci->mode != None && m; m = m->next)
+			if (!m->crtc && m->mx == ci->x && m->my == ci->y
+			&& m->mw == (int)ci->width && m->mh == (int)ci->height) {
+				m->crtc = res->crtcs[i];
+				break;
+			}
+		XRRFreeCrtcInfo(ci);
+	}
+	XRRFreeScreenResources(res);
+	/* a monitor not shown by a CRTC, keep rescanning the screens */
+	for (m = mons; m && m->crtc; m = m->next);
+	if (m) {
+		for (m = mons; m; m = m->next)
+			m->crtc = None;
+		return;
+	}
+	XRRSelectInput(dpy, root, RRCrtcChangeNotifyMask);
+	haverandr = 1;
+}
+#endif /* XRANDR */
+
+int
+intcmp(const void *a, const void *b)
+{
+	return *(const int *)a < *(const int *)b ? -1 : *(const int *)a > *(const int *)b;
+}
+
+void
+ipcaccept(int fd)
+{
+	/* watches has room for every client ipc_accept() admits */
+	if ((fd = ipc_accept()) >= 0)
+		addwatch(fd, ipcclient);
+}
+
+void
+ipcclient(int fd)
+{
+	if (!ipc_handle(fd, runcommand))
+		delwatch(fd);
+}
+
+/* sends the monitors whose focus, tags, layout or title changed since the
+ * last call to the subscribers of those changes */
+void
+ipcnotify(void)
+{
+	IPCEventMsg ev;
+	Monitor *m;
+
+	if (!ipc_subscribed(IPCEvFocus | IPCEvTag | IPCEvLayout | IPCEvTitle))
+		return;
+	for (m = mons; m; m = m->next) {
+		memset(&ev, 0, sizeof ev);
+		ev.monitor = m->num;
+		ev.selected = m == selmon;
+		ev.tags = m->tagset[m->seltags];
+		updateclients(m);
+		ev.occupied = m->occ;
+		ev.urgent = m->urg;
+		if (m->sel) {
+			ev.window = m->sel->win;
+			strcpy(ev.title, m->sel->name);
+		}
+		strcpy(ev.ltsymbol, m->ltsymbol);
+
+		if (ev.window != m->ipcstate.window || ev.selected != m->ipcstate.selected)
+			ev.event |= IPCEvFocus;
+		if (ev.tags != m->ipcstate.tags || ev.occupied != m->ipcstate.occupied
+		|| ev.urgent != m->ipcstate.urgent)
+			ev.event |= IPCEvTag;
+		if (strcmp(ev.ltsymbol, m->ipcstate.ltsymbol))
+			ev.event |= IPCEvLayout;
+		if (strcmp(ev.title, m->ipcstate.title))
+			ev.event |= IPCEvTitle;
+		if (ev.event)
+			ipc_broadcast(&ev);
+		m->ipcstate = ev;
+	}
+}
+
+/* XCheckIfEvent() predicate taking motion events up to a button release */
+Bool
+ismotion(Display *dpy, XEvent *ev, XPointer released)
+{
+	if (ev->type == ButtonRelease)
+		*(int *)released = 1;
+	return !*(int *)released && ev->type == MotionNotify;
+}
+
 #ifdef XINERAMA
 static int
 isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
@@ -1144,20 +2221,33 @@ isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
 }
 #endif /* XINERAMA */
 
+/* orders keys by keysym, keys of the same keysym in the order of keys */
+int
+keycmp(const void *a, const void *b)
+{
+	const Key *x = *(const Key **)a, *y = *(const Key **)b;
+
+	if (x->keysym != y->keysym)
+		return x->keysym < y->keysym ? -1 : 1;
+	return x < y ? -1 : x > y;
+}
+
 void
 keypress(XEvent *e)
 {
-	unsigned int i;
-	KeySym keysym;
+	unsigned int i, mod;
+	const Key *k;
 	XKeyEvent *ev;
 
 	ev = &e->xkey;
-	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
-	for (i = 0; i < LENGTH(keys); i++)
-		if (keysym == keys[i].keysym
-		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
-		&& keys[i].func)
-			keys[i].func(&(keys[i].arg));
+	if (ev->keycode >= LENGTH(keyfirst) - 1)
+		return;
+	mod = CLEANMASK(ev->state);
+	for (i = keyfirst[ev->keycode]; i < keyfirst[ev->keycode + 1]; i++) {
+		k = keybinds[i].key;
+		if (keybinds[i].mod == mod && k->func)
+			k->func(&k->arg);
+	}
 }
 
 void
@@ -1177,13 +2267,95 @@ killclient(const Arg *arg)
 }
 
 void
-manage(Window w, XWindowAttributes *wa)
+listinsert(WinList *l, int i, Window w)
+{
+	if (l->n == l->cap) {
+		l->cap = l->cap ? l->cap * 2 : 64;
+		if (!(l->w = realloc(l->w, l->cap * sizeof(Window))))
+			die("realloc:");
+	}
+	memmove(&l->w[i + 1], &l->w[i], (l->n - i) * sizeof(Window));
+	l->w[i] = w;
+	l->n++;
+}
+
+/* returns the former index of w, or -1 if l had no w */
+int
+listremove(WinList *l, Window w)
+{
+	int i;
+
+	for (i = 0; i < l->n && l->w[i] != w; i++);
+	if (i == l->n)
+		return -1;
+	memmove(&l->w[i], &l->w[i + 1], (l->n - i - 1) * sizeof(Window));
+	l->n--;
+	return i;
+}
+
+/* restores the monitors from the state saved by savestate(), the clients
+ * are restored as scan() manages them */
+void
+loadstate(void)
+{
+	int format, i, nm, nc;
+	unsigned long n, extra;
+	unsigned char *p = NULL;
+	long *v, *ms;
+	Atom real;
+	Monitor *m;
+
+	if (XGetWindowProperty(dpy, root, stateatom, 0L, 1L << 16, True, XA_CARDINAL,
+		&real, &format, &n, &extra, &p) != Success || !p)
+		return;
+	v = (long *)p;
+	if (format != 32 || n < 4 || v[0] != STATEVERSION
+	|| (nm = v[2]) < 0 || (nc = v[3]) < 0
+	|| n != 4 + (unsigned long)nm * MonLast + (unsigned long)nc * (CliLast + 1)) {
+		XFree(p);
+		return;
+	}
+	for (i = 0; i < nm; i++) {
+		ms = v + 4 + i * MonLast;
+		for (m = mons; m && m->num != ms[MonNum]; m = m->next);
+		if (!m)
+			continue;
+		if (ms[MonTags0] & TAGMASK)
+			m->tagset[0] = ms[MonTags0] & TAGMASK;
+		if (ms[MonTags1] & TAGMASK)
+			m->tagset[1] = ms[MonTags1] & TAGMASK;
+		m->seltags = ms[MonSeltags] & 1;
+		m->sellt = ms[MonSellt] & 1;
+		if ((unsigned long)ms[MonLt0] < LENGTH(layouts))
+			m->lt[0] = &layouts[ms[MonLt0]];
+		if ((unsigned long)ms[MonLt1] < LENGTH(layouts))
+			m->lt[1] = &layouts[ms[MonLt1]];
+		strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
+		m->nmaster = MAX(ms[MonNmaster], 0);
+		if (ms[MonMfact] >= 50 && ms[MonMfact] <= 950)
+			m->mfact = ms[MonMfact] / 1000.0;
+		m->showbar = ms[MonShowbar] != 0;
+		updatebarpos(m);
+		resizebarwin(m);
+		markclients(m);
+		if (m->num == v[1])
+			selmon = m;
+	}
+	savedstate = v;
+	savedclients = v + 4 + nm * MonLast;
+	savedstack = savedclients + nc * CliLast;
+	nsaved = nc;
+}
+
+/* p holds the properties of w if they were fetched already, else NULL */
+void
+manage(Window w, XWindowAttributes *wa, WinProps *p)
 {
 	Client *c, *t = NULL;
-	Window trans = None;
+	WinProps props;
 	XWindowChanges wc;
 
-	c = ecalloc(1, sizeof(Client));
+	c = allocclient();
 	c->win = w;
 	/* geometry */
 	c->x = c->oldx = wa->x;
@@ -1192,13 +2364,15 @@ manage(Window w, XWindowAttributes *wa)
 	c->h = c->oldh = wa->height;
 	c->oldbw = wa->border_width;
 
-	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	if (!p)
+		fetchprops(w, p = &props);
+	strcpy(c->name, p->name);
+	if (p->trans != None && (t = wintoclient(p->trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
-	} else {
+	} else if (!restoreclient(c)) {
 		c->mon = selmon;
-		applyrules(c);
+		applyrules(c, p->class, p->instance);
 	}
 
 	if (c->x + WIDTH(c) > c->mon->wx + c->mon->ww)
@@ -1213,27 +2387,53 @@ manage(Window w, XWindowAttributes *wa)
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
 	XSetWindowBorder(dpy, w, scheme[SchemeNorm][ColBorder].pixel);
 	configure(c); /* propagates border_width, if size doesn't change */
-	updatewindowtype(c);
-	updatesizehints(c);
-	updatewmhints(c);
+	setwindowtype(c, p->state, p->wtype);
+	setsizehints(c, &p->size);
+	setwmhints(c, &p->wmh);
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	grabbuttons(c, 0);
 	if (!c->isfloating)
-		c->isfloating = c->oldstate = trans != None || c->isfixed;
-	if (c->isfloating)
-		XRaiseWindow(dpy, c->win);
+		c->isfloating = c->oldstate = p->trans != None || c->isfixed;
+	listinsert(&clientlist, clientlist.n, c->win);
+	raisewin(c->win); /* puts the window in the stacking order model */
 	attachaside(c);
 	attachstack(c);
-	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
-		(unsigned char *) &(c->win), 1);
+	attachhash(clienthash, c);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
-	setclientstate(c, NormalState);
+	c->sx = c->x + 2 * sw;
+	c->sy = c->y;
+	/* found unmapped by scan(), showhide() maps it if it is on a selected tag */
+	if (scanning && hidemode && wa->map_state != IsViewable)
+		c->hidden = 1;
+	setclientstate(c, c->hidden ? IconicState : NormalState);
 	if (c->mon == selmon)
 		unfocus(selmon->sel, 0);
 	c->mon->sel = c;
-	arrange(c->mon);
-	XMapWindow(dpy, c->win);
-	focus(NULL);
+	if (!scanning) /* scan() arranges once all windows are managed */
+		arrange(c->mon);
+	if (!c->hidden) /* not on a selected tag, showhide() maps it */
+		XMapWindow(dpy, c->win);
+	if (!scanning)
+		focus(NULL);
+}
+
+/* schedule a bar repaint for the next time the event queue is empty,
+ * m == NULL marks the bars of all monitors */
+void
+markbar(Monitor *m)
+{
+	if (m)
+		m->bardirty = 1;
+	else for (m = mons; m; m = m->next)
+		m->bardirty = 1;
+}
+
+/* the visible clients or the tag masks of m changed */
+void
+markclients(Monitor *m)
+{
+	m->clientsdirty = 1;
+	m->bardirty = 1;
 }
 
 void
@@ -1255,29 +2455,12 @@ maprequest(XEvent *e)
 	Client *i;
 	if ((i = wintosystrayicon(ev->window))) {
 		sendevent(i->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_WINDOW_ACTIVATE, 0, systray->win, XEMBED_EMBEDDED_VERSION);
-		resizebarwin(selmon);
-		updatesystray();
 	}
 
 	if (!XGetWindowAttributes(dpy, ev->window, &wa) || wa.override_redirect)
 		return;
 	if (!wintoclient(ev->window))
-		manage(ev->window, &wa);
-}
-
-void
-monocle(Monitor *m)
-{
-	unsigned int n = 0;
-	Client *c;
-
-	for (c = m->clients; c; c = c->next)
-		if (ISVISIBLE(c))
-			n++;
-	if (n > 0) /* override layout symbol */
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
-	for (c = nexttiled(m->clients); c; c = nexttiled(c->next))
-		resize(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw, 0);
+		manage(ev->window, &wa, NULL);
 }
 
 void
@@ -1304,7 +2487,7 @@ movemouse(const Arg *arg)
 	Client *c;
 	Monitor *m;
 	XEvent ev;
-	Time lasttime = 0;
+	Drag d;
 
 	if (!(c = selmon->sel))
 		return;
@@ -1318,19 +2501,20 @@ movemouse(const Arg *arg)
 		return;
 	if (!getrootptr(&x, &y))
 		return;
+	dragbegin(&d, c);
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		dragevent(&d, &ev, MOUSEMASK|ExposureMask|SubstructureRedirectMask);
 		switch(ev.type) {
 		case ConfigureRequest:
 		case Expose:
 		case MapRequest:
+			drawoutline(&d, 0);
 			handler[ev.type](&ev);
+			drawbars();
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / refreshrate))
-				continue;
-			lasttime = ev.xmotion.time;
-
+			/* only the newest position before the button release matters */
+			while (nextmotion(&ev));
 			nx = ocx + (ev.xmotion.x - x);
 			ny = ocy + (ev.xmotion.y - y);
 			if (abs(selmon->wx - nx) < snap)
@@ -1342,13 +2526,16 @@ movemouse(const Arg *arg)
 			else if (abs((selmon->wy + selmon->wh) - (ny + HEIGHT(c))) < snap)
 				ny = selmon->wy + selmon->wh - HEIGHT(c);
 			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
-			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap))
+			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap)) {
+				drawoutline(&d, 0);
 				togglefloating(NULL);
+			}
 			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
-				resize(c, nx, ny, c->w, c->h, 1);
+				dragto(&d, nx, ny, c->w, c->h);
 			break;
 		}
 	} while (ev.type != ButtonRelease);
+	dragend(&d);
 	XUngrabPointer(dpy, CurrentTime);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
 		sendmon(c, m);
@@ -1357,6 +2544,26 @@ movemouse(const Arg *arg)
 	}
 }
 
+/* moves the window of c unless it already is at x, y */
+void
+movewin(Client *c, int x, int y)
+{
+	if (c->sx == x && c->sy == y)
+		return;
+	XMoveWindow(dpy, c->win, x, y);
+	c->sx = x;
+	c->sy = y;
+}
+
+/* takes the next motion event queued, unless a button release is before it */
+int
+nextmotion(XEvent *ev)
+{
+	int released = 0;
+
+	return XCheckIfEvent(dpy, ev, ismotion, (XPointer)&released);
+}
+
 Client *
 nexttagged(Client *c) {
 	Client *walked = c->mon->clients;
@@ -1374,6 +2581,83 @@ nexttiled(Client *c)
 	return c;
 }
 
+/* returns the visible client following c in the client list if dir is
+ * positive or preceding it otherwise, wrapping around and skipping floating
+ * clients if tiled is set */
+Client *
+nextvisible(Monitor *m, Client *c, int dir, int tiled)
+{
+	Client *t;
+	unsigned int i, j;
+
+	updateclients(m);
+	for (i = 0; i < m->nvis && m->vis[i] != c; i++);
+	if (i == m->nvis)
+		return NULL;
+	for (j = 1; j <= m->nvis; j++) {
+		t = m->vis[(i + (dir > 0 ? j : m->nvis - j)) % m->nvis];
+		if (!tiled || !t->isfloating)
+			return t;
+	}
+	return NULL;
+}
+
+/* the first monitor whose window area has the point, looked up in a grid
+ * of the window area edges */
+Monitor *
+pointtomon(int x, int y)
+{
+	MonIndex *mi = &monindex;
+	int lo, hi, i;
+
+	if (mi->dirty)
+		updatemonindex();
+	if (mi->nx < 2 || mi->ny < 2 || x < mi->xs[0] || x >= mi->xs[mi->nx - 1]
+	|| y < mi->ys[0] || y >= mi->ys[mi->ny - 1])
+		return NULL;
+	for (lo = 0, hi = mi->nx - 1; hi - lo > 1;)
+		if (mi->xs[(lo + hi) / 2] <= x)
+			lo = (lo + hi) / 2;
+		else
+			hi = (lo + hi) / 2;
+	i = lo;
+	for (lo = 0, hi = mi->ny - 1; hi - lo > 1;)
+		if (mi->ys[(lo + hi) / 2] <= y)
+			lo = (lo + hi) / 2;
+		else
+			hi = (lo + hi) / 2;
+	return mi->cells[lo * (mi->nx - 1) + i];
+}
+
+/* waits up to timeout ms, -1 for ever, for the X connection or a watched
+ * fd to be readable and runs the handlers of the readable watched fds */
+void
+pollwatches(int timeout)
+{
+	struct pollfd fds[MAXWATCHES + 1];
+	int i, j, n;
+
+	fds[0].fd = ConnectionNumber(dpy);
+	fds[0].events = POLLIN;
+	for (n = 0; n < nwatches; n++) {
+		fds[n + 1].fd = watches[n].fd;
+		fds[n + 1].events = POLLIN;
+	}
+	if (poll(fds, n + 1, timeout) < 0) {
+		if (errno == EINTR)
+			return;
+		die("poll:");
+	}
+	/* handlers may add or remove watches, look each fd up again */
+	for (i = 1; i <= n; i++) {
+		if (!fds[i].revents)
+			continue;
+		for (j = 0; j < nwatches && watches[j].fd != fds[i].fd; j++);
+		if (j < nwatches)
+			watches[j].func(fds[i].fd);
+	}
+}
+
 void
 pop(Client *c)
 {
@@ -1397,12 +2681,12 @@ propertynotify(XEvent *e)
 		}
 		else
 			updatesystrayiconstate(c, ev);
-		resizebarwin(selmon);
-		updatesystray();
 	}
 
-	if ((ev->window == root) && (ev->atom == XA_WM_NAME))
-		updatestatus();
+	if ((ev->window == root) && (ev->atom == XA_WM_NAME)) {
+		if (!builtinstatus)
+			updatestatus();
+	}
 	else if (ev->state == PropertyDelete)
 		return; /* ignore */
 	else if ((c = wintoclient(ev->window))) {
@@ -1410,21 +2694,30 @@ propertynotify(XEvent *e)
 		default: break;
 		case XA_WM_TRANSIENT_FOR:
 			if (!c->isfloating && (XGetTransientForHint(dpy, c->win, &trans)) &&
-				(c->isfloating = (wintoclient(trans)) != NULL))
+				(c->isfloating = (wintoclient(trans)) != NULL)) {
+				markclients(c->mon);
 				arrange(c->mon);
+			}
 			break;
 		case XA_WM_NORMAL_HINTS:
+#ifdef XCB
+			/* the reply is only waited for once the hints are needed */
+			if (c->hintsck.sequence)
+				xcb_discard_reply(XGetXCBConnection(dpy), c->hintsck.sequence);
+			c->hintsck = xcb_get_property(XGetXCBConnection(dpy), 0, c->win,
+				XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 0, 18);
+#endif /* XCB */
 			c->hintsvalid = 0;
 			break;
 		case XA_WM_HINTS:
 			updatewmhints(c);
-			drawbars();
+			markbar(c->mon);
 			break;
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updatetitle(c);
 			if (c == c->mon->sel)
-				drawbar(c->mon);
+				markbar(c->mon);
 		}
 		if (ev->atom == netatom[NetWMWindowType])
 			updatewindowtype(c);
@@ -1438,12 +2731,60 @@ quit(const Arg *arg)
 	running = 0;
 }
 
+void
+raisewin(Window w)
+{
+	if (!stacked(w, None)) {
+		XRaiseWindow(dpy, w);
+		restackwin(w, None);
+	}
+}
+
+void
+readevents(void)
+{
+	int i, j;
+	XEvent *ev, *old;
+
+	/* a button press may start movemouse() or resizemouse(), which read the
+	 * following events themselves, so it always ends the batch */
+	evbatchlen = evbatchpos = 0;
+	do {
+		ev = &evbatch[evbatchlen++];
+		XNextEvent(dpy, ev);
+	} while (batchevents && ev->type != ButtonPress && evbatchlen < LENGTH(evbatch)
+		&& XEventsQueued(dpy, QueuedAfterReading));
+
+	/* type 0 is no valid event type and has no handler, use it to mark
+	 * events superseded by a later one */
+	for (i = evbatchlen - 1; i > 0; i--) {
+		ev = &evbatch[i];
+		if (ev->type != MotionNotify && ev->type != PropertyNotify
+		&& ev->type != ConfigureRequest)
+			continue;
+		for (j = i - 1; j >= 0; j--) {
+			old = &evbatch[j];
+			if (!old->type || evwindow(old) != evwindow(ev))
+				continue;
+			if (supersedes(ev, old))
+				old->type = 0;
+			/* only changes of other properties may be passed over, any
+			 * other event of the window keeps its order */
+			else if (old->type != PropertyNotify || ev->type != PropertyNotify
+			|| old->xproperty.atom == ev->xproperty.atom)
+				break;
+		}
+	}
+}
+
 Monitor *
 recttomon(int x, int y, int w, int h)
 {
 	Monitor *m, *r = selmon;
 	int a, area = 0;
 
+	if (w == 1 && h == 1)
+		return (m = pointtomon(x, y)) ? m : selmon;
 	for (m = mons; m; m = m->next)
 		if ((a = INTERSECT(x, y, w, h, m)) > area) {
 			area = a;
@@ -1452,6 +2793,28 @@ recttomon(int x, int y, int w, int h)
 	return r;
 }
 
+#if defined(XINERAMA) || defined(XRANDR)
+/* hands the clients of m to another monitor and removes it */
+void
+removemon(Monitor *m)
+{
+	Monitor *t = m == mons ? mons->next : mons;
+	Client *c;
+
+	while ((c = m->clients)) {
+		m->clients = c->next;
+		detachstack(c);
+		c->mon = t;
+		attachaside(c);
+		attachstack(c);
+		t->resized = 1;
+	}
+	if (m == selmon)
+		selmon = t;
+	cleanupmon(m);
+}
+#endif
+
 static void
 removesystrayicon(Client *i)
 {
@@ -1460,9 +2823,25 @@ removesystrayicon(Client *i)
 	if (!showsystray || !i)
 		return;
 	for (ii = &systray->icons; *ii && *ii != i; ii = &(*ii)->next);
-	if (ii)
+	if (*ii)
 		*ii = i->next;
-	free(i);
+	detachhash(iconhash, i);
+	listremove(&stacking, i->win);
+	freeclient(i);
+}
+
+/* windows leaving the root, tray icons among them, no longer take part in
+ * its stacking order, windows joining it go on top */
+void
+reparentnotify(XEvent *e)
+{
+	XReparentEvent *ev = &e->xreparent;
+
+	if (ev->event != root)
+		return;
+	listremove(&stacking, ev->window);
+	if (ev->parent == root)
+		listinsert(&stacking, stacking.n, ev->window);
 }
 
 void
@@ -1484,39 +2863,21 @@ void
 resizeclient(Client *c, int x, int y, int w, int h)
 {
 	XWindowChanges wc;
-	unsigned int n;
-	unsigned int gapoffset;
-	unsigned int gapincr;
-	Client *nbc;
 
-	wc.border_width = c->bw;
-
-	/* Get number of clients for the client's monitor */
-	for (n = 0, nbc = nexttiled(c->mon->clients); nbc; nbc = nexttiled(nbc->next), n++);
-
-	/* Do nothing if layout is floating */
-	if (c->isfloating || c->mon->lt[c->mon->sellt]->arrange == NULL) {
-		gapincr = gapoffset = 0;
-	} else {
-		/* Remove border and gap if layout is monocle or only one client */
-		if (c->mon->lt[c->mon->sellt]->arrange == monocle || n == 1) {
-			gapoffset = 0;
-			gapincr = -2 * borderpx;
-			wc.border_width = 0;
-		} else {
-			gapoffset = gappx;
-			gapincr = 2 * gappx;
-		}
-	}
-
-	c->oldx = c->x; c->x = wc.x = x + gapoffset;
-	c->oldy = c->y; c->y = wc.y = y + gapoffset;
-	c->oldw = c->w; c->w = wc.width = w - gapincr;
-	c->oldh = c->h; c->h = wc.height = h - gapincr;
+	/* borders and gaps of tiled clients are up to arrangemon() */
+	if (c->bare && !c->isfloating && c->mon->lt[c->mon->sellt]->arrange)
+		wc.border_width = 0;
+	else
+		wc.border_width = c->bw;
+	c->oldx = c->x; c->x = wc.x = x;
+	c->oldy = c->y; c->y = wc.y = y;
+	c->oldw = c->w; c->w = wc.width = w;
+	c->oldh = c->h; c->h = wc.height = h;
 
 	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
+	c->sx = wc.x;
+	c->sy = wc.y;
 	configure(c);
-	XSync(dpy, False);
 }
 
 static void
@@ -1525,11 +2886,8 @@ resizerequest(XEvent *e)
 	XResizeRequestEvent *ev = &e->xresizerequest;
 	Client *i;
 
-	if ((i = wintosystrayicon(ev->window))) {
+	if ((i = wintosystrayicon(ev->window)))
 		updatesystrayicongeom(i, ev->width, ev->height);
-		resizebarwin(selmon);
-		updatesystray();
-	}
 }
 
 void
@@ -1539,7 +2897,7 @@ resizemouse(const Arg *arg)
 	Client *c;
 	Monitor *m;
 	XEvent ev;
-	Time lasttime = 0;
+	Drag d;
 
 	if (!(c = selmon->sel))
 		return;
@@ -1552,36 +2910,41 @@ resizemouse(const Arg *arg)
 		None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
 		return;
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
+	dragbegin(&d, c);
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		dragevent(&d, &ev, MOUSEMASK|ExposureMask|SubstructureRedirectMask);
 		switch(ev.type) {
 		case ConfigureRequest:
 		case Expose:
 		case MapRequest:
+			drawoutline(&d, 0);
 			handler[ev.type](&ev);
+			drawbars();
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / refreshrate))
-				continue;
-			lasttime = ev.xmotion.time;
-
+			/* only the newest size before the button release matters */
+			while (nextmotion(&ev));
 			nw = MAX(ev.xmotion.x - ocx - 2 * c->bw + 1, 1);
 			nh = MAX(ev.xmotion.y - ocy - 2 * c->bw + 1, 1);
 			if (c->mon->wx + nw >= selmon->wx && c->mon->wx + nw <= selmon->wx + selmon->ww
 			&& c->mon->wy + nh >= selmon->wy && c->mon->wy + nh <= selmon->wy + selmon->wh)
 			{
 				if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
-				&& (abs(nw - c->w) > snap || abs(nh - c->h) > snap))
+				&& (abs(nw - c->w) > snap || abs(nh - c->h) > snap)) {
+					drawoutline(&d, 0);
 					togglefloating(NULL);
+				}
 			}
 			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
-				resize(c, c->x, c->y, nw, nh, 1);
+				dragto(&d, c->x, c->y, nw, nh);
 			break;
 		}
 	} while (ev.type != ButtonRelease);
+	dragend(&d);
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
 	XUngrabPointer(dpy, CurrentTime);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	discardevents(EnterNotify);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
 		sendmon(c, m);
 		selmon = m;
@@ -1596,65 +2959,386 @@ restack(Monitor *m)
 	XEvent ev;
 	XWindowChanges wc;
 
-	drawbar(m);
+	markbar(m);
 	if (!m->sel)
 		return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
-		XRaiseWindow(dpy, m->sel->win);
+		raisewin(m->sel->win);
 	if (m->lt[m->sellt]->arrange) {
 		wc.stack_mode = Below;
 		wc.sibling = m->barwin;
 		for (c = m->stack; c; c = c->snext)
 			if (!c->isfloating && ISVISIBLE(c)) {
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
+				if (!stacked(c->win, wc.sibling)) {
+					XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
+					restackwin(c->win, wc.sibling);
+				}
 				wc.sibling = c->win;
 			}
 	}
 	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	discardevents(EnterNotify);
+}
+
+/* tracks w being stacked right below sibling, or on top if sibling is None,
+ * in the stacking order model */
+void
+restackwin(Window w, Window sibling)
+{
+	int i;
+
+	listremove(&stacking, w);
+	for (i = 0; sibling && i < stacking.n && stacking.w[i] != sibling; i++);
+	listinsert(&stacking, sibling ? i : stacking.n, w);
+	clientlistdirty = 1;
+}
+
+/* gives c the monitor, tags and floating geometry it had before the
+ * restart, returns 0 if it was not managed then */
+int
+restoreclient(Client *c)
+{
+	Monitor *m;
+	long *v;
+	int i;
+
+	for (i = 0; i < nsaved && (Window)savedclients[i * CliLast + CliWin] != c->win; i++);
+	if (i == nsaved)
+		return 0;
+	v = savedclients + i * CliLast;
+	for (m = mons; m && m->num != v[CliMon]; m = m->next);
+	c->mon = m ? m : selmon;
+	c->tags = v[CliTags] & TAGMASK ? v[CliTags] & TAGMASK : c->mon->tagset[c->mon->seltags];
+	if ((c->isfloating = v[CliFloating] != 0)) {
+		c->x = v[CliX];
+		c->y = v[CliY];
+		c->w = v[CliW];
+		c->h = v[CliH];
+	}
+	return 1;
+}
+
+/* puts the restored clients back in their client list and focus order */
+void
+restoreorder(void)
+{
+	Client *c;
+	Monitor *m;
+	int i;
+
+	if (!savedstate)
+		return;
+	for (i = nsaved - 1; i >= 0; i--)
+		if ((c = wintoclient(savedclients[i * CliLast + CliWin]))) {
+			detach(c);
+			attach(c);
+		}
+	for (i = nsaved - 1; i >= 0; i--)
+		if ((c = wintoclient(savedstack[i]))) {
+			detachstack(c);
+			attachstack(c);
+		}
+	for (m = mons; m; m = m->next)
+		for (m->sel = m->stack; m->sel && !ISVISIBLE(m->sel); m->sel = m->sel->snext);
+	XFree(savedstate);
+	savedstate = NULL;
+	nsaved = 0;
+}
+
+#ifdef XRANDR
+/* a CRTC switched off or cloning another monitor removes its monitor, one
+ * showing something new adds one, the others resize theirs */
+void
+rrnotify(XEvent *e)
+{
+	XRRCrtcChangeNotifyEvent *ev = (XRRCrtcChangeNotifyEvent *)e;
+	Monitor *m, *t;
+	int i;
+
+	if (ev->subtype != RRNotify_CrtcChange)
+		return;
+	for (m = mons; m && m->crtc != ev->crtc; m = m->next);
+	for (t = mons; t; t = t->next)
+		if (t != m && t->mx == ev->x && t->my == ev->y
+		&& t->mw == (int)ev->width && t->mh == (int)ev->height)
+			break;
+	if (ev->mode == None || !ev->width || !ev->height || t) {
+		if (!m || !mons->next)
+			return;
+		removemon(m);
+	} else {
+		if (!m) {
+			for (t = mons; t->next; t = t->next);
+			t->next = m = createmon();
+			m->crtc = ev->crtc;
+		} else if (m->mx == ev->x && m->my == ev->y
+		&& m->mw == (int)ev->width && m->mh == (int)ev->height)
+			return;
+		m->mx = m->wx = ev->x;
+		m->my = m->wy = ev->y;
+		m->mw = m->ww = ev->width;
+		m->mh = m->wh = ev->height;
+		m->resized = 1;
+		updatebarpos(m);
+	}
+	for (i = 0, t = mons; t; t = t->next, i++)
+		t->num = i;
+	updatemons();
+}
+#endif /* XRANDR */
+
+void
+run(void)
+{
+	XEvent *ev;
+	Trace t;
+
+	/* main event loop */
+	XSync(dpy, False);
+	while (waitevents()) {
+		readevents();
+		for (; running && evbatchpos < evbatchlen; evbatchpos++) {
+			ev = &evbatch[evbatchpos];
+#ifdef XRANDR
+			if (haverandr && ev->type == rrevbase + RRNotify) {
+				rrnotify(ev);
+				continue;
+			}
+#endif /* XRANDR */
+			if (ev->type >= LASTEvent || !handler[ev->type])
+				continue;
+			if (tracing)
+				tracebegin(&t);
+			handler[ev->type](ev); /* call handler */
+			if (tracing)
+				traceend(&evstats[ev->type], &t);
+		}
+	}
+}
+
+/* runs a command received on the IPC socket on the selected monitor */
+int
+runcommand(const IPCCommandMsg *cmd)
+{
+	Arg a = {0};
+	size_t i;
+
+	for (i = 0; i < LENGTH(commands) && strcmp(commands[i].name, cmd->name); i++);
+	if (i == LENGTH(commands))
+		return IPCErrUnknown;
+	switch (commands[i].argtype) {
+	case ArgInt:
+		a.i = cmd->arg;
+		break;
+	case ArgUint:
+		a.ui = cmd->arg;
+		break;
+	case ArgFloat: /* thousandths */
+		a.f = cmd->arg / 1000.0;
+		break;
+	case ArgLayout: /* index in layouts, negative toggles the previous one */
+		if (cmd->arg >= (int)LENGTH(layouts))
+			return IPCErrArg;
+		a.v = cmd->arg < 0 ? NULL : &layouts[cmd->arg];
+		break;
+	}
+	commands[i].func(&a);
+	return 0;
+}
+
+/* keeps the fallback fonts found for the next dwm, $XDG_CACHE_HOME may not
+ * exist yet */
+void
+savefonts(void)
+{
+	char dir[sizeof fontcachefile], *p;
+
+	if (!fontcachefile[0])
+		return;
+	strcpy(dir, fontcachefile);
+	*strrchr(dir, '/') = '\0';
+	if ((p = strrchr(dir, '/'))) {
+		*p = '\0';
+		mkdir(dir, 0700);
+		*p = '/';
+	}
+	mkdir(dir, 0700);
+	drw_fontset_savecache(drw, fontcachefile);
+}
+
+/* keeps the monitors, clients and focus order in a root window property
+ * for the dwm exec'd by a restart */
+void
+savestate(void)
+{
+	Client *c;
+	Monitor *m;
+	long *v, *s;
+	int nm = 0, nc = 0;
+
+	for (m = mons; m; m = m->next, nm++)
+		for (c = m->clients; c; c = c->next, nc++);
+	v = ecalloc(4 + nm * MonLast + nc * (CliLast + 1), sizeof(long));
+	v[0] = STATEVERSION;
+	v[1] = selmon->num;
+	v[2] = nm;
+	v[3] = nc;
+	s = v + 4;
+	for (m = mons; m; m = m->next, s += MonLast) {
+		s[MonNum] = m->num;
+		s[MonTags0] = m->tagset[0];
+		s[MonTags1] = m->tagset[1];
+		s[MonSeltags] = m->seltags;
+		s[MonSellt] = m->sellt;
+		s[MonLt0] = m->lt[0] - layouts;
+		s[MonLt1] = m->lt[1] - layouts;
+		s[MonNmaster] = m->nmaster;
+		s[MonMfact] = m->mfact * 1000 + 0.5;
+		s[MonShowbar] = m->showbar;
+	}
+	/* the geometry of a fullscreen client is the one it returns to */
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next, s += CliLast) {
+			s[CliWin] = c->win;
+			s[CliMon] = m->num;
+			s[CliTags] = c->tags;
+			s[CliFloating] = c->isfullscreen ? c->oldstate : c->isfloating;
+			s[CliX] = c->isfullscreen ? c->oldx : c->x;
+			s[CliY] = c->isfullscreen ? c->oldy : c->y;
+			s[CliW] = c->isfullscreen ? c->oldw : c->w;
+			s[CliH] = c->isfullscreen ? c->oldh : c->h;
+		}
+	for (m = mons; m; m = m->next)
+		for (c = m->stack; c; c = c->snext)
+			*s++ = c->win;
+	XChangeProperty(dpy, root, stateatom, XA_CARDINAL, 32, PropModeReplace,
+		(unsigned char *)v, s - v);
+	XSync(dpy, False);
+	free(v);
 }
 
+#ifdef XCB
+/* the attributes, then the properties of all windows are requested in one
+ * batch each, which keeps a restart down to a few round trips */
 void
-run(void)
+scan(void)
 {
-	XEvent ev;
-	/* main event loop */
-	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
-}
+	xcb_connection_t *xc = XGetXCBConnection(dpy);
+	xcb_query_tree_reply_t *tree;
+	xcb_get_window_attributes_reply_t *attr;
+	xcb_get_geometry_reply_t *geom;
+	xcb_get_property_reply_t *state;
+	xcb_window_t *wins;
+	struct {
+		xcb_get_window_attributes_cookie_t attr;
+		xcb_get_geometry_cookie_t geom;
+		xcb_get_property_cookie_t state, props[PropLast];
+		XWindowAttributes wa;
+		WinProps p;
+		int manage;
+	} *win;
+	Monitor *m;
+	int i, num, trans;
 
+	if (!(tree = xcb_query_tree_reply(xc, xcb_query_tree(xc, root), NULL)))
+		return;
+	wins = xcb_query_tree_children(tree);
+	num = xcb_query_tree_children_length(tree);
+	/* the stacking order model starts out as the server's */
+	for (stacking.n = 0; stacking.n < num;)
+		listinsert(&stacking, stacking.n, wins[stacking.n]);
+	win = ecalloc(num ? num : 1, sizeof(*win));
+	loadstate();
+	for (i = 0; i < num; i++) {
+		win[i].attr = xcb_get_window_attributes(xc, wins[i]);
+		win[i].geom = xcb_get_geometry(xc, wins[i]);
+		win[i].state = xcb_get_property(xc, 0, wins[i], wmatom[WMState], wmatom[WMState], 0, 2);
+	}
+	for (i = 0; i < num; i++) {
+		attr = xcb_get_window_attributes_reply(xc, win[i].attr, NULL);
+		geom = xcb_get_geometry_reply(xc, win[i].geom, NULL);
+		state = xcb_get_property_reply(xc, win[i].state, NULL);
+		if (attr && geom && !attr->override_redirect) {
+			win[i].wa.x = geom->x;
+			win[i].wa.y = geom->y;
+			win[i].wa.width = geom->width;
+			win[i].wa.height = geom->height;
+			win[i].wa.border_width = geom->border_width;
+			win[i].wa.map_state = attr->map_state;
+			win[i].wa.override_redirect = attr->override_redirect;
+			win[i].manage = attr->map_state == IsViewable
+				|| (state && state->format == 32 && xcb_get_property_value_length(state) >= 4
+				&& *(uint32_t *)xcb_get_property_value(state) == IconicState);
+		}
+		free(attr);
+		free(geom);
+		free(state);
+		if (win[i].manage)
+			requestprops(xc, wins[i], win[i].props);
+	}
+	for (i = 0; i < num; i++)
+		if (win[i].manage)
+			readprops(xc, wins[i], win[i].props, &win[i].p);
+
+	scanning = 1;
+	for (trans = 0; trans < 2; trans++) /* transients after the others */
+		for (i = 0; i < num; i++)
+			if (win[i].manage && (win[i].p.trans != None) == trans)
+				manage(wins[i], &win[i].wa, &win[i].p);
+	restoreorder();
+	scanning = 0;
+	for (m = mons; m; m = m->next)
+		arrange(m); /* restacks the windows manage() raised in tree order */
+	focus(NULL);
+	free(win);
+	free(tree);
+}
+#else
 void
 scan(void)
 {
 	unsigned int i, num;
 	Window d1, d2, *wins = NULL;
 	XWindowAttributes wa;
+	Monitor *m;
 
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
-				manage(wins[i], &wa);
-		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
-				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
-				manage(wins[i], &wa);
-		}
-		if (wins)
-			XFree(wins);
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num))
+		return;
+	/* the stacking order model starts out as the server's */
+	for (stacking.n = 0; stacking.n < (int)num;)
+		listinsert(&stacking, stacking.n, wins[stacking.n]);
+	loadstate();
+	scanning = 1;
+	for (i = 0; i < num; i++) {
+		if (!XGetWindowAttributes(dpy, wins[i], &wa)
+		|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
+			continue;
+		if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
+			manage(wins[i], &wa, NULL);
 	}
+	for (i = 0; i < num; i++) { /* now the transients */
+		if (!XGetWindowAttributes(dpy, wins[i], &wa))
+			continue;
+		if (XGetTransientForHint(dpy, wins[i], &d1)
+		&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
+			manage(wins[i], &wa, NULL);
+	}
+	restoreorder();
+	scanning = 0;
+	for (m = mons; m; m = m->next)
+		arrange(m); /* restacks the windows manage() raised in tree order */
+	focus(NULL);
+	if (wins)
+		XFree(wins);
 }
+#endif /* XCB */
 
 void
 sendmon(Client *c, Monitor *m)
 {
+	Monitor *old = c->mon;
+
 	if (c->mon == m)
 		return;
 	unfocus(c, 1);
@@ -1665,7 +3349,26 @@ sendmon(Client *c, Monitor *m)
 	attachaside(c);
 	attachstack(c);
 	focus(NULL);
-	arrange(NULL);
+	arrange(old);
+	arrange(m);
+}
+
+/* records what a bar segment shows, returns 1 if that changed since it
+ * was last drawn */
+int
+setbarseg(BarSeg *s, int x, int w, const char *text, unsigned int state)
+{
+	if (!text)
+		text = "";
+	if (s->drawn && s->x == x && s->w == w && s->state == state
+	&& !strcmp(s->text, text))
+		return 0;
+	s->x = x;
+	s->w = w;
+	s->state = state;
+	s->drawn = 1;
+	snprintf(s->text, sizeof s->text, "%s", text);
+	return 1;
 }
 
 void
@@ -1736,13 +3439,15 @@ setfullscreen(Client *c, int fullscreen)
 		c->oldbw = c->bw;
 		c->bw = 0;
 		c->isfloating = 1;
+		markclients(c->mon);
 		resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
-		XRaiseWindow(dpy, c->win);
+		raisewin(c->win);
 	} else if (!fullscreen && c->isfullscreen){
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)0, 0);
 		c->isfullscreen = 0;
 		c->isfloating = c->oldstate;
+		markclients(c->mon);
 		c->bw = c->oldbw;
 		c->x = c->oldx;
 		c->y = c->oldy;
@@ -1764,7 +3469,7 @@ setlayout(const Arg *arg)
 	if (selmon->sel)
 		arrange(selmon);
 	else
-		drawbar(selmon);
+		markbar(selmon);
 }
 
 /* arg > 1.0 will set mfact absolutely */
@@ -1782,10 +3487,57 @@ setmfact(const Arg *arg)
 	arrange(selmon);
 }
 
+void
+setsizehints(Client *c, XSizeHints *size)
+{
+	if (size->flags & PBaseSize) {
+		c->basew = size->base_width;
+		c->baseh = size->base_height;
+	} else if (size->flags & PMinSize) {
+		c->basew = size->min_width;
+		c->baseh = size->min_height;
+	} else
+		c->basew = c->baseh = 0;
+	if (size->flags & PResizeInc) {
+		c->incw = size->width_inc;
+		c->inch = size->height_inc;
+	} else
+		c->incw = c->inch = 0;
+	if (size->flags & PMaxSize) {
+		c->maxw = size->max_width;
+		c->maxh = size->max_height;
+	} else
+		c->maxw = c->maxh = 0;
+	if (size->flags & PMinSize) {
+		c->minw = size->min_width;
+		c->minh = size->min_height;
+	} else if (size->flags & PBaseSize) {
+		c->minw = size->base_width;
+		c->minh = size->base_height;
+	} else
+		c->minw = c->minh = 0;
+	if (size->flags & PAspect) {
+		c->mina = (float)size->min_aspect.y / size->min_aspect.x;
+		c->maxa = (float)size->max_aspect.x / size->max_aspect.y;
+	} else
+		c->maxa = c->mina = 0.0;
+	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
+	c->hintsvalid = 1;
+	c->hintw = c->hinth = 0; /* sizes are at least 1, nothing cached */
+}
+
+/* arms timer id to fire in ms milliseconds, a negative ms disarms it */
+void
+settimer(int id, int ms)
+{
+	timers[id].due = ms < 0 ? -1 : timestamp() + ms;
+}
+
 void
 setup(void)
 {
 	int i;
+	char *p;
 	XSetWindowAttributes wa;
 	Atom utf8string;
 	struct sigaction sa;
@@ -1807,12 +3559,28 @@ setup(void)
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
+	drw = drw_create(dpy, screen, root, 1, 1); /* sized by updatebardrw() */
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
 	bh = drw->fonts->h + 2;
+	if (fontcache) {
+		if ((p = getenv("XDG_CACHE_HOME")) && p[0])
+			snprintf(fontcachefile, sizeof fontcachefile, "%s/dwm/fonts", p);
+		else if ((p = getenv("HOME")))
+			snprintf(fontcachefile, sizeof fontcachefile, "%s/.cache/dwm/fonts", p);
+		if (fontcachefile[0])
+			drw_fontset_loadcache(drw, fontcachefile);
+	}
+	/* looked up once the first bars are drawn */
+	for (i = 0; i < LENGTH(fontprewarm); i++)
+		drw_fontset_queue(drw, fontprewarm[i]);
+	settimer(TimerFonts, 0);
 	updategeom();
+#ifdef XRANDR
+	initrandr();
+#endif /* XRANDR */
+	updatebardrw();
 	sp = sidepad;
 	vp = (topbar == 1) ? vertpad : - vertpad;
 	/* init atoms */
@@ -1821,6 +3589,16 @@ setup(void)
 	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
 	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
 	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
+	stateatom = XInternAtom(dpy, "_DWM_RESTART_STATE", False);
+#ifdef XSYNC
+	syncrequest = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	synccounter = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
+	if (XSyncQueryExtension(dpy, &syncevent, &syncerror)) {
+		int major = SYNC_MAJOR_VERSION, minor = SYNC_MINOR_VERSION;
+
+		havesync = XSyncInitialize(dpy, &major, &minor);
+	}
+#endif /* XSYNC */
 	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
 	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
 	netatom[NetSystemTray] = XInternAtom(dpy, "_NET_SYSTEM_TRAY_S0", False);
@@ -1834,6 +3612,7 @@ setup(void)
 	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetClientListStacking] = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", False);
 	xatom[Manager] = XInternAtom(dpy, "MANAGER", False);
 	xatom[Xembed] = XInternAtom(dpy, "_XEMBED", False);
 	xatom[XembedInfo] = XInternAtom(dpy, "_XEMBED_INFO", False);
@@ -1845,10 +3624,26 @@ setup(void)
 	scheme = ecalloc(LENGTH(colors), sizeof(Clr *));
 	for (i = 0; i < LENGTH(colors); i++)
 		scheme[i] = drw_scm_create(drw, colors[i], 3);
+	compilerules();
 	/* init system tray */
 	updatesystray();
 	/* init bars */
 	updatebars();
+	if (builtinstatus) {
+		struct pollfd fds[3];
+
+		status_init(statusmods, LENGTH(statusmods));
+		for (i = status_pollfds(fds, LENGTH(fds)); i > 0; i--)
+			addwatch(fds[i - 1].fd, statusevent);
+	}
+	/* init IPC socket */
+	if (ipcsockname[0] && getenv("XDG_RUNTIME_DIR")) {
+		char path[256];
+
+		snprintf(path, sizeof(path), "%s/%s", getenv("XDG_RUNTIME_DIR"), ipcsockname);
+		if ((i = ipc_listen(path)) >= 0)
+			addwatch(i, ipcaccept);
+	}
 	updatestatus();
 	updatebarpos(selmon);
 	/* supporting window for NetWMCheck */
@@ -1863,6 +3658,7 @@ setup(void)
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 		PropModeReplace, (unsigned char *) netatom, NetLast);
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
 	/* select events */
 	wa.cursor = cursor[CurNormal]->cursor;
 	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask
@@ -1880,6 +3676,7 @@ seturgent(Client *c, int urg)
 	XWMHints *wmh;
 
 	c->isurgent = urg;
+	markclients(c->mon);
 	if (!(wmh = XGetWMHints(dpy, c->win)))
 		return;
 	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
@@ -1888,21 +3685,66 @@ seturgent(Client *c, int urg)
 }
 
 void
-showhide(Client *c)
+setwindowtype(Client *c, Atom state, Atom wtype)
 {
-	if (!c)
-		return;
-	if (ISVISIBLE(c)) {
-		/* show clients top down */
-		XMoveWindow(dpy, c->win, c->x, c->y);
-		if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen)
-			resize(c, c->x, c->y, c->w, c->h, 0);
-		showhide(c->snext);
+	if (state == netatom[NetWMFullscreen])
+		setfullscreen(c, 1);
+	if (wtype == netatom[NetWMWindowTypeDialog]) {
+		c->isfloating = 1;
+		markclients(c->mon);
+	}
+}
+
+void
+setwmhints(Client *c, XWMHints *wmh)
+{
+	if (c == selmon->sel && wmh->flags & XUrgencyHint) {
+		wmh->flags &= ~XUrgencyHint;
+		XSetWMHints(dpy, c->win, wmh);
 	} else {
-		/* hide clients bottom up */
-		showhide(c->snext);
-		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
+		c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
+		markclients(c->mon);
 	}
+	if (wmh->flags & InputHint)
+		c->neverfocus = !wmh->input;
+	else
+		c->neverfocus = 0;
+}
+
+void
+showhide(Client *stack)
+{
+	Client *c;
+
+	/* show clients top down */
+	for (c = stack; c; c = c->snext)
+		if (ISVISIBLE(c)) {
+			movewin(c, c->x, c->y);
+			if (c->hidden) {
+				/* the geometry applied before it was hidden still holds */
+				c->hidden = 0;
+				XMapWindow(dpy, c->win);
+				setclientstate(c, NormalState);
+				/* focus() ran while it was unmapped */
+				if (c == selmon->sel && !c->neverfocus)
+					XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
+				if (INTERSECT(c->x, c->y, WIDTH(c), HEIGHT(c), c->mon) > 0)
+					continue;
+			}
+			if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen)
+				resize(c, c->x, c->y, c->w, c->h, 0);
+		}
+	/* then hide the others */
+	for (c = stack; c; c = c->snext)
+		if (!ISVISIBLE(c) && !c->hidden) {
+			if (hidemode) {
+				c->hidden = 1;
+				c->unmapserial = NextRequest(dpy);
+				XUnmapWindow(dpy, c->win);
+				setclientstate(c, IconicState);
+			} else
+				movewin(c, WIDTH(c) * -2, c->y);
+		}
 }
 
 void
@@ -1919,6 +3761,19 @@ sigterm(int unused)
 	quit(&a);
 }
 
+/* sorts v and drops duplicates, returns the number left */
+int
+sortedges(int *v, int n)
+{
+	int i, k;
+
+	qsort(v, n, sizeof(int), intcmp);
+	for (i = k = 0; i < n; i++)
+		if (!k || v[i] != v[k - 1])
+			v[k++] = v[i];
+	return k;
+}
+
 void
 spawn(const Arg *arg)
 {
@@ -1941,11 +3796,130 @@ spawn(const Arg *arg)
 	}
 }
 
+/* tracks w being stacked right above sibling, or at the bottom if sibling
+ * is None or not known, as the server reported it */
+void
+stackabove(Window w, Window sibling)
+{
+	int i, j;
+
+	i = listremove(&stacking, w);
+	for (j = 0; sibling && j < stacking.n && stacking.w[j] != sibling; j++);
+	j = sibling && j < stacking.n ? j + 1 : 0;
+	listinsert(&stacking, j, w);
+	if (i != j && wintoclient(w))
+		clientlistdirty = 1;
+}
+
+/* returns 1 if w is right below sibling, or on top if sibling is None, in the
+ * stacking order model */
+int
+stacked(Window w, Window sibling)
+{
+	int i;
+
+	for (i = 0; i < stacking.n && stacking.w[i] != w; i++);
+	if (i == stacking.n)
+		return 0;
+	if (!sibling)
+		return i == stacking.n - 1;
+	return i + 1 < stacking.n && stacking.w[i + 1] == sibling;
+}
+
+/* with a positive arg->i starts recording the handler and bar statistics
+ * and dumps them every arg->i seconds, otherwise dumps them and stops */
+void
+stats(const Arg *arg)
+{
+	if (arg->i > 0) {
+		if (!tracing) {
+			memset(evstats, 0, sizeof evstats);
+			memset(&barstats, 0, sizeof barstats);
+			tracestart = timestamp();
+		}
+		tracing = arg->i;
+		settimer(TimerStats, tracing * 1000);
+	} else if (tracing) {
+		dumpstats();
+		tracing = 0;
+		settimer(TimerStats, -1);
+	}
+}
+
+void
+statstimer(void)
+{
+	dumpstats();
+	settimer(TimerStats, tracing * 1000);
+}
+
+void
+statusevent(int fd)
+{
+	struct pollfd pfd = { fd, POLLIN, POLLIN }, fds[3];
+	int i;
+
+	if (status_update(fd < 0 ? NULL : &pfd, fd < 0 ? 0 : 1, stext, sizeof(stext), statussep))
+		markbar(selmon);
+	/* the status engine closed fd, e.g. its audio child exited */
+	if (fd >= 0) {
+		for (i = status_pollfds(fds, LENGTH(fds)); i > 0 && fds[i - 1].fd != fd; i--);
+		if (!i)
+			delwatch(fd);
+	}
+	settimer(TimerStatus, status_timeout());
+}
+
+void
+statustimer(void)
+{
+	statusevent(-1);
+}
+
+int
+supersedes(XEvent *ev, XEvent *old)
+{
+	XConfigureRequestEvent *cr = &ev->xconfigurerequest, *ocr = &old->xconfigurerequest;
+	unsigned long mask;
+
+	if (ev->type != old->type || evwindow(ev) != evwindow(old))
+		return 0;
+	switch (ev->type) {
+	case MotionNotify:
+		return 1;
+	case PropertyNotify:
+		return ev->xproperty.atom == old->xproperty.atom
+			&& ev->xproperty.state == old->xproperty.state;
+	case ConfigureRequest:
+		/* a border width change is handled on its own by configurerequest() */
+		if ((cr->value_mask | ocr->value_mask) & CWBorderWidth)
+			return 0;
+		/* carry over what only the older request asked for */
+		mask = ocr->value_mask & ~cr->value_mask;
+		if (mask & CWX)
+			cr->x = ocr->x;
+		if (mask & CWY)
+			cr->y = ocr->y;
+		if (mask & CWWidth)
+			cr->width = ocr->width;
+		if (mask & CWHeight)
+			cr->height = ocr->height;
+		if (mask & CWSibling)
+			cr->above = ocr->above;
+		if (mask & CWStackMode)
+			cr->detail = ocr->detail;
+		cr->value_mask |= mask;
+		return 1;
+	}
+	return 0;
+}
+
 void
 tag(const Arg *arg)
 {
 	if (selmon->sel && arg->ui & TAGMASK) {
 		selmon->sel->tags = arg->ui & TAGMASK;
+		markclients(selmon);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -1959,32 +3933,13 @@ tagmon(const Arg *arg)
 	sendmon(selmon->sel, dirtomon(arg->i));
 }
 
-void
-tile(Monitor *m)
+long long
+timestamp(void)
 {
-	unsigned int i, n, h, mw, my, ty;
-	Client *c;
-
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++);
-	if (n == 0)
-		return;
+	struct timespec ts;
 
-	if (n > m->nmaster)
-		mw = m->nmaster ? (m->ww * m->mfact) : 0;
-	else
-		mw = m->ww;
-	for (i = my = ty = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++)
-		if (i < m->nmaster) {
-			h = (m->wh - my) / (MIN(n, m->nmaster) - i);
-			resize(c, m->wx, m->wy + my, mw - (2*c->bw) + (n > 1 ? gappx : 0), h - (2*c->bw), 0);
-			if (my + HEIGHT(c) < m->wh)
-				my += HEIGHT(c);
-		} else {
-			h = (m->wh - ty) / (n - i);
-			resize(c, m->wx + mw, m->wy + ty, m->ww - mw - (2*c->bw), h - (2*c->bw), 0);
-			if (ty + HEIGHT(c) < m->wh)
-				ty += HEIGHT(c);
-		}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 void
@@ -1993,17 +3948,6 @@ togglebar(const Arg *arg)
 	selmon->showbar = !selmon->showbar;
 	updatebarpos(selmon);
 	resizebarwin(selmon);
-	if (showsystray) {
-		XWindowChanges wc;
-		if (!selmon->showbar)
-			wc.y = -bh;
-		else if (selmon->showbar) {
-			wc.y = 0;
-			if (!selmon->topbar)
-				wc.y = selmon->mh - bh;
-		}
-		XConfigureWindow(dpy, systray->win, CWY, &wc);
-	}
 	arrange(selmon);
 }
 
@@ -2015,6 +3959,7 @@ togglefloating(const Arg *arg)
 	if (selmon->sel->isfullscreen) /* no support for fullscreen windows */
 		return;
 	selmon->sel->isfloating = !selmon->sel->isfloating || selmon->sel->isfixed;
+	markclients(selmon);
 	if (selmon->sel->isfloating)
 		resize(selmon->sel, selmon->sel->x, selmon->sel->y,
 			selmon->sel->w, selmon->sel->h, 0);
@@ -2031,6 +3976,7 @@ toggletag(const Arg *arg)
 	newtags = selmon->sel->tags ^ (arg->ui & TAGMASK);
 	if (newtags) {
 		selmon->sel->tags = newtags;
+		markclients(selmon);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -2043,11 +3989,38 @@ toggleview(const Arg *arg)
 
 	if (newtagset) {
 		selmon->tagset[selmon->seltags] = newtagset;
+		markclients(selmon);
 		focus(NULL);
 		arrange(selmon);
 	}
 }
 
+void
+tracebegin(Trace *t)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t->ns = (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	t->req = NextRequest(dpy);
+	t->seen = LastKnownRequestProcessed(dpy);
+}
+
+/* Xlib counts no round trips, but the last request the server is known to
+ * have processed only moves when dwm read a reply, error or event */
+void
+traceend(Stat *s, const Trace *t)
+{
+	Trace e;
+
+	tracebegin(&e);
+	s->count++;
+	s->ns += e.ns - t->ns;
+	s->maxns = MAX(s->maxns, e.ns - t->ns);
+	s->reqs += e.req - t->req;
+	s->syncs += e.seen != t->seen;
+}
+
 void
 unfocus(Client *c, int setfocus)
 {
@@ -2069,6 +4042,11 @@ unmanage(Client *c, int destroyed)
 
 	detach(c);
 	detachstack(c);
+	detachhash(clienthash, c);
+#ifdef XCB
+	if (c->hintsck.sequence)
+		xcb_discard_reply(XGetXCBConnection(dpy), c->hintsck.sequence);
+#endif /* XCB */
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -2076,14 +4054,18 @@ unmanage(Client *c, int destroyed)
 		XSelectInput(dpy, c->win, NoEventMask);
 		XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); /* restore border */
 		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
-		setclientstate(c, WithdrawnState);
+		if (!c->hidden) /* hidden ones stay iconic, scan() finds them again */
+			setclientstate(c, WithdrawnState);
 		XSync(dpy, False);
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
-	free(c);
+	listremove(&clientlist, c->win);
+	if (destroyed) /* still a child of the root otherwise */
+		listremove(&stacking, c->win);
+	clientlistdirty = 1;
+	freeclient(c);
 	focus(NULL);
-	updateclientlist();
 	arrange(m);
 }
 
@@ -2094,19 +4076,36 @@ unmapnotify(XEvent *e)
 	XUnmapEvent *ev = &e->xunmap;
 
 	if ((c = wintoclient(ev->window))) {
-		if (ev->send_event)
-			setclientstate(c, WithdrawnState);
-		else
+		if (ev->send_event) {
+			/* a hidden client withdrawing, its own unmap did nothing */
+			if (c->hidden) {
+				c->hidden = 0;
+				unmanage(c, 0);
+			} else
+				setclientstate(c, WithdrawnState);
+		} else if (ev->serial != c->unmapserial) /* not hidden by showhide() */
 			unmanage(c, 0);
 	}
 	else if ((c = wintosystrayicon(ev->window))) {
 		/* KLUDGE! sometimes icons occasionally unmap their windows, but do
 		 * _not_ destroy them. We map those windows back */
 		XMapRaised(dpy, c->win);
-		updatesystray();
 	}
 }
 
+/* bars are drawn one at a time, so the pixmap only needs to hold the widest */
+void
+updatebardrw(void)
+{
+	unsigned int w = 1;
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		w = MAX(w, m->ww);
+	if (w != drw->w || bh != drw->h)
+		drw_resize(drw, w, bh);
+}
+
 void
 updatebars(void)
 {
@@ -2129,6 +4128,7 @@ updatebars(void)
 				CWOverrideRedirect|CWBackPixmap|CWEventMask, &wa);
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
+		restackwin(m->barwin, None);
 		XSetClassHint(dpy, m->barwin, &ch);
 	}
 }
@@ -2144,20 +4144,61 @@ updatebarpos(Monitor *m)
 		m->wy = m->topbar ? m->wy + bh + vp : m->wy;
 	} else
 		m->by = -bh - vp;
+	monindex.dirty = 1;
 }
 
+/* writes the client lists once the event queue drains, each with a single
+ * request */
 void
 updateclientlist(void)
+{
+	Window *wins;
+	int i, n;
+
+	if (!clientlistdirty)
+		return;
+	clientlistdirty = 0;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) clientlist.w, clientlist.n);
+	wins = ecalloc(MAX(stacking.n, 1), sizeof(Window));
+	for (i = n = 0; i < stacking.n; i++)
+		if (wintoclient(stacking.w[i]))
+			wins[n++] = stacking.w[i];
+	XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) wins, n);
+	free(wins);
+}
+
+/* rebuilds the visible and tiled client arrays and the tag masks of m if
+ * they are out of date */
+void
+updateclients(Monitor *m)
 {
 	Client *c;
-	Monitor *m;
+	unsigned int n;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+	if (!m->clientsdirty)
+		return;
+	m->clientsdirty = 0;
+	for (n = 0, c = m->clients; c; c = c->next, n++);
+	if (n > m->clientcap) {
+		m->clientcap = n * 2;
+		if (!(m->vis = realloc(m->vis, m->clientcap * sizeof(Client *)))
+		|| !(m->tiled = realloc(m->tiled, m->clientcap * sizeof(Client *)))
+		|| !(m->rects = realloc(m->rects, m->clientcap * sizeof(Rect))))
+			die("realloc:");
+	}
+	m->nvis = m->ntiled = m->occ = m->urg = 0;
+	for (c = m->clients; c; c = c->next) {
+		m->occ |= c->tags;
+		if (c->isurgent)
+			m->urg |= c->tags;
+		if (!ISVISIBLE(c))
+			continue;
+		m->vis[m->nvis++] = c;
+		if (!c->isfloating)
+			m->tiled[m->ntiled++] = c;
+	}
 }
 
 int
@@ -2168,7 +4209,6 @@ updategeom(void)
 #ifdef XINERAMA
 	if (XineramaIsActive(dpy)) {
 		int i, j, n, nn;
-		Client *c;
 		Monitor *m;
 		XineramaScreenInfo *info = XineramaQueryScreens(dpy, &nn);
 		XineramaScreenInfo *unique = NULL;
@@ -2196,6 +4236,7 @@ updategeom(void)
 			|| unique[i].width != m->mw || unique[i].height != m->mh)
 			{
 				dirty = 1;
+				m->resized = 1;
 				m->num = i;
 				m->mx = m->wx = unique[i].x_org;
 				m->my = m->wy = unique[i].y_org;
@@ -2206,17 +4247,9 @@ updategeom(void)
 		/* removed monitors if n > nn */
 		for (i = nn; i < n; i++) {
 			for (m = mons; m && m->next; m = m->next);
-			while ((c = m->clients)) {
+			if (m->clients)
 				dirty = 1;
-				m->clients = c->next;
-				detachstack(c);
-				c->mon = mons;
-				attachaside(c);
-				attachstack(c);
-			}
-			if (m == selmon)
-				selmon = mons;
-			cleanupmon(m);
+			removemon(m);
 		}
 		free(unique);
 	} else
@@ -2226,6 +4259,7 @@ updategeom(void)
 			mons = createmon();
 		if (mons->mw != sw || mons->mh != sh) {
 			dirty = 1;
+			mons->resized = 1;
 			mons->mw = mons->ww = sw;
 			mons->mh = mons->wh = sh;
 			updatebarpos(mons);
@@ -2238,6 +4272,67 @@ updategeom(void)
 	return dirty;
 }
 
+void
+updatemonindex(void)
+{
+	MonIndex *mi = &monindex;
+	Monitor *m;
+	int i, j, n;
+
+	for (n = 0, m = mons; m; m = m->next, n++);
+	free(mi->xs);
+	free(mi->ys);
+	free(mi->cells);
+	mi->xs = ecalloc(2 * n + 1, sizeof(int));
+	mi->ys = ecalloc(2 * n + 1, sizeof(int));
+	mi->nx = mi->ny = 0;
+	for (m = mons; m; m = m->next) {
+		mi->xs[mi->nx++] = m->wx;
+		mi->xs[mi->nx++] = m->wx + m->ww;
+		mi->ys[mi->ny++] = m->wy;
+		mi->ys[mi->ny++] = m->wy + m->wh;
+	}
+	mi->nx = sortedges(mi->xs, mi->nx);
+	mi->ny = sortedges(mi->ys, mi->ny);
+	mi->cells = ecalloc(MAX((mi->nx - 1) * (mi->ny - 1), 1), sizeof(Monitor *));
+	for (j = 0; j < mi->ny - 1; j++)
+		for (i = 0; i < mi->nx - 1; i++) {
+			for (m = mons; m; m = m->next)
+				if (mi->xs[i] >= m->wx && mi->xs[i] < m->wx + m->ww
+				&& mi->ys[j] >= m->wy && mi->ys[j] < m->wy + m->wh)
+					break;
+			mi->cells[j * (mi->nx - 1) + i] = m;
+		}
+	mi->dirty = 0;
+}
+
+/* updates the bars, fullscreen clients and layouts of the monitors whose
+ * geometry changed */
+void
+updatemons(void)
+{
+	Monitor *m;
+	Client *c;
+
+	updatebardrw();
+	updatebars();
+	for (m = mons; m; m = m->next) {
+		if (!m->resized)
+			continue;
+		for (c = m->clients; c; c = c->next)
+			if (c->isfullscreen)
+				resizeclient(c, m->mx, m->my, m->mw, m->mh);
+		resizebarwin(m);
+		markbar(m);
+	}
+	focus(NULL);
+	for (m = mons; m; m = m->next)
+		if (m->resized) {
+			m->resized = 0;
+			arrange(m);
+		}
+}
+
 void
 updatenumlockmask(void)
 {
@@ -2259,58 +4354,44 @@ updatesizehints(Client *c)
 {
 	long msize;
 	XSizeHints size;
+#ifdef XCB
+	xcb_get_property_reply_t *rep;
 
+	if (c->hintsck.sequence) {
+		size.flags = PSize;
+		if ((rep = xcb_get_property_reply(XGetXCBConnection(dpy), c->hintsck, NULL))) {
+			readsizehints(rep, &size);
+			free(rep);
+		}
+		c->hintsck.sequence = 0;
+		setsizehints(c, &size);
+		return;
+	}
+#endif /* XCB */
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
-	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
-	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
-	} else
-		c->basew = c->baseh = 0;
-	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
-	} else
-		c->incw = c->inch = 0;
-	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
-	} else
-		c->maxw = c->maxh = 0;
-	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
-	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
-	} else
-		c->minw = c->minh = 0;
-	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
-	} else
-		c->maxa = c->mina = 0.0;
-	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
-	c->hintsvalid = 1;
+	setsizehints(c, &size);
 }
 
 void
 updatestatus(void)
 {
-	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
+	if (builtinstatus)
+		statusevent(-1);
+	else if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
 		strcpy(stext, "dwm-"VERSION);
-	drawbar(selmon);
-	updatesystray();
+	markbar(selmon);
 }
 
 static void
 updatesystrayicongeom(Client *i, int w, int h)
 {
+	int ow, oh;
+
 	if (i) {
+		ow = i->w;
+		oh = i->h;
 		i->h = bh;
 		if (w == h)
 			i->w = bh;
@@ -2327,6 +4408,8 @@ updatesystrayicongeom(Client *i, int w, int h)
 				i->w = (int) ((float)bh * ((float)i->w / (float)i->h));
 			i->h = bh;
 		}
+		if (i->w != ow || i->h != oh)
+			i->sx = -1; /* resized by updatesystray() */
 	}
 }
 
@@ -2339,9 +4422,10 @@ updatesystrayiconstate(Client *i, XPropertyEvent *ev)
 	if (!showsystray || !i || !ev)
 		return;
 	if (ev->atom == xatom[XembedInfo]) {
-		flags = getatomprop(i, xatom[XembedInfo]);
+		flags = getatomprop(i->win, xatom[XembedInfo]);
 		if (flags & XEMBED_MAPPED && !i->tags) {
 			i->tags = 1;
+			i->sx = -1;
 			code = XEMBED_WINDOW_ACTIVATE;
 			XMapRaised(dpy, i->win);
 			setclientstate(i, NormalState);
@@ -2354,32 +4438,33 @@ updatesystrayiconstate(Client *i, XPropertyEvent *ev)
 			return;
 		sendevent(i->win, xatom[Xembed], StructureNotifyMask, CurrentTime, code, 0, systray->win, XEMBED_EMBEDDED_VERSION);
 	}
-	resizebarwin(selmon);
-	updatesystray();
 }
 
+/* Creates the tray window on the first call. Later calls, once per drained
+ * event queue, only configure the icons and the tray window whose geometry
+ * changed since, resizing the bars by marking them. */
 static void
 updatesystray(void)
 {
-	unsigned int w = 0;
+	XSetWindowAttributes wa;
+	XWindowChanges wc;
+	XClassHint ch = {"dwm", "dwm"};
+	Monitor *m;
 	Client *i;
+	int x, y, w = 0;
+
 	if (!showsystray)
 		return;
+	m = systraytomon(NULL);
 	if (!systray) {
-		if (!(systray = (Systray *)calloc(1, sizeof(Systray))))
-			die("fatal: could not malloc() %u bytes\n", sizeof(Systray));
-		/* Create window at correct position, but don't map it yet */
-		unsigned int x = selmon->wx + (systrayonleft ? 0 : selmon->ww - 1);
-		unsigned int y = selmon->by;
-		systray->win = XCreateSimpleWindow(dpy, root, x, y, 1, bh, 0, 0, 0);
-		if (!systray->win)
-			die("fatal: could not create systray window\n");
-		XSetWindowAttributes wa;
-		wa.event_mask = ButtonPressMask | ExposureMask;
+		systray = ecalloc(1, sizeof(Systray));
+		wa.event_mask = SubstructureNotifyMask;
 		wa.override_redirect = True;
 		wa.background_pixel = scheme[SchemeNorm][ColBg].pixel;
-		XChangeWindowAttributes(dpy, systray->win, CWEventMask|CWOverrideRedirect|CWBackPixel, &wa);
-		XSelectInput(dpy, systray->win, SubstructureNotifyMask);
+		systray->win = XCreateWindow(dpy, root, m->wx + (systrayonleft ? 0 : m->ww - 1), m->by,
+			1, bh, 0, CopyFromParent, CopyFromParent, CopyFromParent,
+			CWEventMask|CWOverrideRedirect|CWBackPixel, &wa);
+		XSetClassHint(dpy, systray->win, &ch);
 		XChangeProperty(dpy, systray->win, netatom[NetSystemTray], XA_ATOM, 32,
 			PropModeReplace, (unsigned char *)&netatom[NetSystemTray], 1);
 		XChangeProperty(dpy, systray->win, netatom[NetSystemTrayOrientation], XA_CARDINAL, 32,
@@ -2398,34 +4483,47 @@ updatesystray(void)
 			ev.data.l[4] = 0;
 			XSendEvent(dpy, root, False, StructureNotifyMask, (XEvent *)&ev);
 		}
-		/* Don't map the window yet - it will be mapped when positioned correctly */
+		/* mapped once it has icons */
 	}
-	XSync(dpy, False);
+
 	for (i = systray->icons; i; i = i->next) {
 		/* skip icons that are not mapped */
 		if (!i->tags)
 			continue;
-		if (i->mon != selmon)
-			i->mon = selmon;
+		i->mon = m;
 		w += systrayspacing;
+		if (i->sx != w) {
+			XMoveResizeWindow(dpy, i->win, w, 0, i->w, i->h);
+			i->x = i->sx = w;
+		}
 		w += i->w;
 	}
-	if (!w) {
+	x = m->wx + (systrayonleft ? 0 : m->ww - w);
+	y = m->by + vp;
+	if (w != systray->w || m != systray->mon) {
+		markbar(m);
+		if (systray->mon && systray->mon != m)
+			markbar(systray->mon);
+	}
+	if (!w && systray->w)
 		XUnmapWindow(dpy, systray->win);
-		return;
+	else if (w) {
+		if (x != systray->x || y != systray->y || w != systray->w)
+			XMoveResizeWindow(dpy, systray->win, x, y, w, bh);
+		if (!systray->w)
+			XMapWindow(dpy, systray->win);
+		/* right above the bar, so below what is raised above the bar */
+		if (!stacked(m->barwin, systray->win)) {
+			wc.sibling = m->barwin;
+			wc.stack_mode = Above;
+			XConfigureWindow(dpy, systray->win, CWSibling|CWStackMode, &wc);
+			stackabove(systray->win, m->barwin);
+		}
 	}
-	XSetWindowAttributes wa;
-	wa.event_mask = ButtonPressMask | ExposureMask;
-	wa.override_redirect = True;
-	wa.background_pixel = scheme[SchemeNorm][ColBg].pixel;
-	XChangeWindowAttributes(dpy, systray->win, CWEventMask|CWOverrideRedirect|CWBackPixel, &wa);
-	XSelectInput(dpy, systray->win, SubstructureNotifyMask);
-	/* Position the window before mapping it */
-	XMoveResizeWindow(dpy, systray->win, selmon->wx + (systrayonleft ? 0 : selmon->ww - w), selmon->by, w, bh);
-	XMapRaised(dpy, systray->win);
-	XClassHint ch = {"dwm", "dwm"};
-	XSetClassHint(dpy, systray->win, &ch);
-	drawbar(selmon);
+	systray->mon = m;
+	systray->x = x;
+	systray->y = y;
+	systray->w = w;
 }
 
 void
@@ -2440,13 +4538,8 @@ updatetitle(Client *c)
 void
 updatewindowtype(Client *c)
 {
-	Atom state = getatomprop(c, netatom[NetWMState]);
-	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
-
-	if (state == netatom[NetWMFullscreen])
-		setfullscreen(c, 1);
-	if (wtype == netatom[NetWMWindowTypeDialog])
-		c->isfloating = 1;
+	setwindowtype(c, getatomprop(c->win, netatom[NetWMState]),
+		getatomprop(c->win, netatom[NetWMWindowType]));
 }
 
 void
@@ -2455,15 +4548,7 @@ updatewmhints(Client *c)
 	XWMHints *wmh;
 
 	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
+		setwmhints(c, wmh);
 		XFree(wmh);
 	}
 }
@@ -2476,6 +4561,7 @@ view(const Arg *arg)
 	selmon->seltags ^= 1; /* toggle sel tagset */
 	if (arg->ui & TAGMASK)
 		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK;
+	markclients(selmon);
 	focus(NULL);
 	arrange(selmon);
 }
@@ -2522,17 +4608,48 @@ viewprev(const Arg *arg)
 	view(&(const Arg){.ui = 1 << (LENGTH(tags) - 1)});
 }
 
+/* blocks until X events are pending, running due timers and the handlers of
+ * readable watched fds meanwhile, returns 0 if dwm is quitting */
+int
+waitevents(void)
+{
+	long long t;
+	int i, timeout;
+
+	while (running) {
+		t = timestamp();
+		for (i = 0; i < TimerLast; i++)
+			if (timers[i].due >= 0 && timers[i].due <= t) {
+				timers[i].due = -1;
+				timers[i].func();
+			}
+		if (XPending(dpy)) {
+			pollwatches(0); /* a stream of X events does not hold them back */
+			return 1;
+		}
+		ipcnotify();
+		updateclientlist();
+		updatesystray();
+		drawbars(); /* repaint dirty bars once per drained queue */
+		XFlush(dpy);
+
+		t = timestamp();
+		timeout = -1;
+		for (i = 0; i < TimerLast; i++)
+			if (timers[i].due >= 0 && (timeout < 0 || timers[i].due - t < timeout))
+				timeout = MAX(timers[i].due - t, 0);
+		pollwatches(timeout);
+	}
+	return 0;
+}
+
 Client *
 wintoclient(Window w)
 {
 	Client *c;
-	Monitor *m;
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	for (c = clienthash[WINHASH(w)]; c && c->win != w; c = c->hnext);
+	return c;
 }
 
 Monitor *
@@ -2560,7 +4677,7 @@ wintosystrayicon(Window w)
 	Client *i = NULL;
 	if (w == systray->win)
 		return NULL;
-	for (i = systray->icons; i && i->win != w; i = i->next) ;
+	for (i = iconhash[WINHASH(w)]; i && i->win != w; i = i->hnext) ;
 	return i;
 }
 
@@ -2578,7 +4695,11 @@ xerror(Display *dpy, XErrorEvent *ee)
 	|| (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
 	|| (ee->request_code == X_GrabButton && ee->error_code == BadAccess)
 	|| (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
-	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable))
+	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable)
+#ifdef XSYNC
+	|| (havesync && ee->error_code == syncerror + XSyncBadCounter)
+#endif /* XSYNC */
+	)
 		return 0;
 	fprintf(stderr, "dwm: fatal error: request code=%d, error code=%d\n",
 		ee->request_code, ee->error_code);
@@ -2623,16 +4744,24 @@ main(int argc, char *argv[])
 		fputs("warning: no locale support\n", stderr);
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("dwm: cannot open display");
+	/* children such as the status audio reader must not hold it */
+	fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
 	checkotherwm();
 	setup();
 #ifdef __OpenBSD__
-	if (pledge("stdio rpath proc exec", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath proc exec unix", NULL) == -1)
 		die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
 	system("$HOME/.config/dwm/autostart.sh &");
 	run();
-	if(restart) execvp(argv[0], argv);
+	savefonts();
+	if (restart) {
+		savestate();
+		if (builtinstatus) /* the new dwm starts its own audio child */
+			status_free();
+		execvp(argv[0], argv);
+	}
 	cleanup();
 	XCloseDisplay(dpy);
 	return EXIT_SUCCESS;
@@ -0,0 +1,224 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "ipc.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define MAXCLIENTS 16
+#define MAXMSG     (sizeof(IPCHeader) + sizeof(IPCCommandMsg))
+
+typedef struct {
+	int fd;                  /* -1 if unused */
+	unsigned int events;     /* subscribed IPCEv* mask */
+	size_t len;              /* bytes buffered in in */
+	unsigned char in[MAXMSG];
+} IPCClient;
+
+static IPCClient clients[MAXCLIENTS];
+static int listenfd = -1;
+static char sockpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static int
+setflags(int fd)
+{
+	return fcntl(fd, F_SETFD, FD_CLOEXEC) != -1
+	    && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != -1;
+}
+
+static IPCClient *
+getclient(int fd)
+{
+	int i;
+
+	for (i = 0; i < MAXCLIENTS && clients[i].fd != fd; i++);
+	return i < MAXCLIENTS ? &clients[i] : NULL;
+}
+
+static void
+dropclient(IPCClient *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->events = 0;
+	c->len = 0;
+}
+
+/* a client not draining its socket is shut down rather than blocking dwm,
+ * its fd becomes readable and is closed by ipc_handle() */
+static int
+sendmessage(IPCClient *c, uint32_t type, const void *payload, uint32_t len)
+{
+	unsigned char buf[sizeof(IPCHeader) + sizeof(IPCEventMsg)];
+	IPCHeader h = { type, len };
+
+	memcpy(buf, &h, sizeof h);
+	memcpy(buf + sizeof h, payload, len);
+	if (send(c->fd, buf, sizeof h + len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)(sizeof h + len)) {
+		shutdown(c->fd, SHUT_RDWR);
+		c->events = 0;
+		return 0;
+	}
+	return 1;
+}
+
+static int
+reply(IPCClient *c, int32_t status)
+{
+	return sendmessage(c, IPCReply, &status, sizeof status);
+}
+
+/* runs the complete messages buffered for c, returns 0 on a protocol error */
+static int
+runmessages(IPCClient *c, int (*command)(const IPCCommandMsg *cmd))
+{
+	IPCHeader h;
+	IPCCommandMsg cmd;
+	uint32_t mask;
+	int ok;
+
+	while (c->len >= sizeof h) {
+		memcpy(&h, c->in, sizeof h);
+		if (h.len > sizeof c->in - sizeof h)
+			return 0;
+		if (c->len < sizeof h + h.len)
+			break;
+		if (h.type == IPCCommand && h.len == sizeof cmd) {
+			memcpy(&cmd, c->in + sizeof h, sizeof cmd);
+			cmd.name[sizeof cmd.name - 1] = '\0';
+			ok = reply(c, command(&cmd));
+		} else if (h.type == IPCSubscribe && h.len == sizeof mask) {
+			memcpy(&mask, c->in + sizeof h, sizeof mask);
+			c->events = mask;
+			ok = reply(c, 0);
+		} else {
+			ok = reply(c, IPCErrMsg);
+		}
+		if (!ok)
+			return 0;
+		c->len -= sizeof h + h.len;
+		memmove(c->in, c->in + sizeof h + h.len, c->len);
+	}
+	return 1;
+}
+
+/* returns the listening fd, or -1 if another dwm owns the socket or it
+ * cannot be created */
+int
+ipc_listen(const char *path)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof sa.sun_path)
+		return -1;
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	for (fd = 0; fd < MAXCLIENTS; fd++)
+		clients[fd].fd = -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	/* only remove a stale socket, not the one of a running dwm */
+	if (!connect(fd, (struct sockaddr *)&sa, sizeof sa)) {
+		fprintf(stderr, "dwm: %s is in use\n", path);
+		close(fd);
+		return -1;
+	}
+	unlink(path);
+	close(fd); /* the state of a socket after a failed connect is unspecified */
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0
+	|| listen(fd, MAXCLIENTS) < 0 || !setflags(fd)) {
+		close(fd);
+		return -1;
+	}
+	strcpy(sockpath, path);
+	return listenfd = fd;
+}
+
+/* returns the fd of the new client, or -1 */
+int
+ipc_accept(void)
+{
+	IPCClient *c;
+	int fd;
+
+	if ((fd = accept(listenfd, NULL, NULL)) < 0)
+		return -1;
+	if (!(c = getclient(-1)) || !setflags(fd)) {
+		close(fd);
+		return -1;
+	}
+	c->fd = fd;
+	return fd;
+}
+
+/* reads and runs the messages of a client, returns 0 once it is gone and
+ * its fd closed */
+int
+ipc_handle(int fd, int (*command)(const IPCCommandMsg *cmd))
+{
+	IPCClient *c;
+	ssize_t n;
+
+	if (!(c = getclient(fd)))
+		return 0;
+	while ((n = read(fd, c->in + c->len, sizeof c->in - c->len)) > 0) {
+		c->len += n;
+		if (!runmessages(c, command))
+			break;
+	}
+	if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		dropclient(c);
+		return 0;
+	}
+	return 1;
+}
+
+void
+ipc_broadcast(const IPCEventMsg *ev)
+{
+	int i;
+
+	for (i = 0; listenfd >= 0 && i < MAXCLIENTS; i++)
+		if (clients[i].fd >= 0 && (clients[i].events & ev->event))
+			sendmessage(&clients[i], IPCEvent, ev, sizeof *ev);
+}
+
+int
+ipc_subscribed(unsigned int events)
+{
+	int i;
+
+	for (i = 0; listenfd >= 0 && i < MAXCLIENTS; i++)
+		if (clients[i].fd >= 0 && (clients[i].events & events))
+			return 1;
+	return 0;
+}
+
+void
+ipc_cleanup(void)
+{
+	int i;
+
+	if (listenfd < 0)
+		return;
+	for (i = 0; i < MAXCLIENTS; i++)
+		if (clients[i].fd >= 0)
+			dropclient(&clients[i]);
+	close(listenfd);
+	unlink(sockpath);
+	listenfd = -1;
+}
@@ -0,0 +1,46 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * Protocol spoken on the dwm socket. Every message is an IPCHeader followed by
+ * len bytes of payload, all integers in host byte order.
+ *
+ *   IPCCommand    client -> dwm, payload IPCCommandMsg, answered by IPCReply
+ *   IPCSubscribe  client -> dwm, payload uint32_t mask of IPCEv* bits,
+ *                 answered by IPCReply
+ *   IPCReply      dwm -> client, payload int32_t, 0 or an IPCErr* value
+ *   IPCEvent      dwm -> subscribed client, payload IPCEventMsg
+ */
+enum { IPCCommand, IPCSubscribe, IPCReply, IPCEvent }; /* message types */
+enum { IPCErrUnknown = -1, IPCErrArg = -2, IPCErrMsg = -3 }; /* replies */
+enum { IPCEvFocus = 1 << 0, IPCEvTag = 1 << 1,
+       IPCEvLayout = 1 << 2, IPCEvTitle = 1 << 3 }; /* events */
+
+typedef struct {
+	uint32_t type;
+	uint32_t len;
+} IPCHeader;
+
+typedef struct {
+	int32_t arg;   /* see the argument kind of the command in config.h */
+	char name[28]; /* NUL terminated */
+} IPCCommandMsg;
+
+typedef struct {
+	uint32_t event;    /* the IPCEv* change this message reports */
+	int32_t monitor;   /* number of the monitor having changed */
+	int32_t selected;  /* 1 if it is the selected monitor */
+	uint32_t tags;     /* selected tags */
+	uint32_t occupied; /* tags having clients */
+	uint32_t urgent;   /* tags having urgent clients */
+	uint32_t window;   /* selected client, 0 if none */
+	char ltsymbol[16];
+	char title[256];
+} IPCEventMsg;
+
+/* Server */
+int ipc_listen(const char *path);
+int ipc_accept(void);
+int ipc_handle(int fd, int (*command)(const IPCCommandMsg *cmd));
+void ipc_broadcast(const IPCEventMsg *ev);
+int ipc_subscribed(unsigned int events);
+void ipc_cleanup(void);
@@ -0,0 +1,130 @@
+/* See LICENSE file for copyright and license details. */
+#include "layout.h"
+
+/* start of part i of n of length len, parts differ by at most one */
+#define SPLIT(len, i, n)        ((int)((long)(len) * (i) / (n)))
+
+static void
+column(Rect *r, int x, int y, int w, int h, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		r[i].x = x;
+		r[i].y = y + SPLIT(h, i, n);
+		r[i].w = w;
+		r[i].h = SPLIT(h, i + 1, n) - SPLIT(h, i, n);
+	}
+}
+
+static void
+row(Rect *r, int x, int y, int w, int h, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		r[i].x = x + SPLIT(w, i, n);
+		r[i].y = y;
+		r[i].w = SPLIT(w, i + 1, n) - SPLIT(w, i, n);
+		r[i].h = h;
+	}
+}
+
+/* size of the master area along a side of length len */
+static int
+mastersize(const LayoutArgs *a, int len)
+{
+	if (a->n <= a->nmaster)
+		return len;
+	return a->nmaster > 0 ? len * a->mfact : 0;
+}
+
+static int
+nmasters(const LayoutArgs *a)
+{
+	return a->nmaster < a->n ? a->nmaster : a->n;
+}
+
+void
+bstack(const LayoutArgs *a, Rect *r)
+{
+	const Rect *s = &a->area;
+	int mh = mastersize(a, s->h), nm = nmasters(a);
+
+	row(r, s->x, s->y, s->w, mh, nm);
+	row(r + nm, s->x, s->y + mh, s->w, s->h - mh, a->n - nm);
+}
+
+/* the master column in the middle, the stack alternating right and left */
+void
+centeredmaster(const LayoutArgs *a, Rect *r)
+{
+	const Rect *s = &a->area;
+	int i, j, n, mw = mastersize(a, s->w), mx = 0, nm = nmasters(a);
+	int nl = (a->n - nm) / 2, nr = a->n - nm - nl;
+
+	if (a->n - nm > 1)
+		mx = (s->w - mw) / 2;
+	column(r, s->x + mx, s->y, mw, s->h, nm);
+	for (i = nm, j = 0; i < a->n; i++, j++) {
+		if (j % 2) {
+			n = nl;
+			r[i].x = s->x;
+			r[i].w = mx;
+		} else {
+			n = nr;
+			r[i].x = s->x + mx + mw;
+			r[i].w = s->w - mw - mx;
+		}
+		r[i].y = s->y + SPLIT(s->h, j / 2, n);
+		r[i].h = SPLIT(s->h, j / 2 + 1, n) - SPLIT(s->h, j / 2, n);
+	}
+}
+
+/* tile with the stack clients on top of each other */
+void
+deck(const LayoutArgs *a, Rect *r)
+{
+	const Rect *s = &a->area;
+	int i, mw = mastersize(a, s->w), nm = nmasters(a);
+
+	column(r, s->x, s->y, mw, s->h, nm);
+	for (i = nm; i < a->n; i++)
+		column(&r[i], s->x + mw, s->y, s->w - mw, s->h, 1);
+}
+
+/* as many columns as rows or one more, the last columns taking the extra
+ * clients */
+void
+grid(const LayoutArgs *a, Rect *r)
+{
+	const Rect *s = &a->area;
+	int cols, rows, col, i = 0;
+
+	for (cols = 1; cols * cols < a->n; cols++);
+	for (col = 0; col < cols; col++) {
+		rows = a->n / cols + (col >= cols - a->n % cols && a->n % cols);
+		column(&r[i], s->x + SPLIT(s->w, col, cols), s->y,
+			SPLIT(s->w, col + 1, cols) - SPLIT(s->w, col, cols), s->h, rows);
+		i += rows;
+	}
+}
+
+void
+monocle(const LayoutArgs *a, Rect *r)
+{
+	int i;
+
+	for (i = 0; i < a->n; i++)
+		r[i] = a->area;
+}
+
+void
+tile(const LayoutArgs *a, Rect *r)
+{
+	const Rect *s = &a->area;
+	int mw = mastersize(a, s->w), nm = nmasters(a);
+
+	column(r, s->x, s->y, mw, s->h, nm);
+	column(r + nm, s->x + mw, s->y, s->w - mw, s->h, a->n - nm);
+}
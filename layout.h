@@ -0,0 +1,21 @@
+/* See LICENSE file for copyright and license details. */
+
+typedef struct {
+	int x, y, w, h;
+} Rect;
+
+typedef struct {
+	Rect area;   /* to fill */
+	int n;       /* tiled clients, at least 1 */
+	int nmaster;
+	float mfact;
+} LayoutArgs;
+
+/* Layouts, fill r[0..n-1] with the outer rectangles of the tiled clients in
+ * client list order. Borders and gaps are taken off by the caller. */
+void bstack(const LayoutArgs *a, Rect *r);
+void centeredmaster(const LayoutArgs *a, Rect *r);
+void deck(const LayoutArgs *a, Rect *r);
+void grid(const LayoutArgs *a, Rect *r);
+void monocle(const LayoutArgs *a, Rect *r);
+void tile(const LayoutArgs *a, Rect *r);
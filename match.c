@@ -0,0 +1,116 @@
+/* See LICENSE file for copyright and license details. */
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+#include "util.h"
+
+/* Aho-Corasick automaton over a trie of the patterns */
+typedef struct {
+	int child;   /* first child, -1 if none */
+	int sibling; /* next child of the parent, -1 if none */
+	int fail;    /* node of the longest proper suffix */
+	int dict;    /* nearest node on the fail chain ending a pattern, 0 if none */
+	int out;     /* first pattern ending here, -1 if none */
+	unsigned char c;
+} Node;
+
+struct Matcher {
+	Node *nodes;
+	int *nextout;          /* next pattern ending at the same node */
+	unsigned char *always; /* patterns occurring in every text */
+	size_t npats;
+};
+
+static int
+child(const Matcher *m, int n, unsigned char c)
+{
+	for (n = m->nodes[n].child; n >= 0 && m->nodes[n].c != c; n = m->nodes[n].sibling);
+	return n;
+}
+
+Matcher *
+match_new(const char *const *pats, size_t npats)
+{
+	Matcher *m;
+	Node *nd;
+	const unsigned char *s;
+	size_t i, size = 1;
+	int n, v, f, w, nnodes = 1, head = 0, tail = 0, *queue;
+
+	for (i = 0; i < npats; i++)
+		if (pats[i])
+			size += strlen(pats[i]);
+	m = ecalloc(1, sizeof(Matcher));
+	m->nodes = nd = ecalloc(size, sizeof(Node));
+	m->nextout = ecalloc(npats ? npats : 1, sizeof(int));
+	m->always = ecalloc(npats ? npats : 1, 1);
+	m->npats = npats;
+	nd[0].child = nd[0].sibling = nd[0].out = -1;
+
+	for (i = 0; i < npats; i++) {
+		if (!pats[i] || !pats[i][0]) {
+			m->always[i] = 1;
+			continue;
+		}
+		for (n = 0, s = (const unsigned char *)pats[i]; *s; s++, n = v) {
+			if ((v = child(m, n, *s)) >= 0)
+				continue;
+			v = nnodes++;
+			nd[v].c = *s;
+			nd[v].child = nd[v].out = -1;
+			nd[v].sibling = nd[n].child;
+			nd[n].child = v;
+		}
+		m->nextout[i] = nd[n].out;
+		nd[n].out = i;
+	}
+
+	/* fail links in breadth first order, a node's are shallower than it */
+	queue = ecalloc(nnodes, sizeof(int));
+	queue[tail++] = 0;
+	while (head < tail) {
+		n = queue[head++];
+		for (v = nd[n].child; v >= 0; v = nd[v].sibling) {
+			queue[tail++] = v;
+			if (n == 0) {
+				nd[v].fail = nd[v].dict = 0;
+				continue;
+			}
+			for (f = nd[n].fail; (w = child(m, f, nd[v].c)) < 0 && f; f = nd[f].fail);
+			nd[v].fail = w >= 0 ? w : 0;
+			nd[v].dict = nd[nd[v].fail].out >= 0 ? nd[v].fail : nd[nd[v].fail].dict;
+		}
+	}
+	free(queue);
+	return m;
+}
+
+void
+match_free(Matcher *m)
+{
+	if (!m)
+		return;
+	free(m->nodes);
+	free(m->nextout);
+	free(m->always);
+	free(m);
+}
+
+/* sets hits[i] to 1 if pattern i occurs in text and to 0 otherwise */
+void
+match_find(const Matcher *m, const char *text, unsigned char *hits)
+{
+	const unsigned char *s;
+	int n = 0, d, p, w;
+
+	memcpy(hits, m->always, m->npats);
+	for (s = (const unsigned char *)text; *s; s++) {
+		for (; (w = child(m, n, *s)) < 0 && n; n = m->nodes[n].fail);
+		n = w >= 0 ? w : 0;
+		for (d = n; d > 0; d = m->nodes[d].dict)
+			for (p = m->nodes[d].out; p >= 0; p = m->nextout[p])
+				hits[p] = 1;
+	}
+}
@@ -0,0 +1,9 @@
+/* See LICENSE file for copyright and license details. */
+
+typedef struct Matcher Matcher;
+
+/* Substring matcher finding all patterns occurring in a text in one pass
+ * over it, NULL and empty patterns occur in every text */
+Matcher *match_new(const char *const *pats, size_t npats);
+void match_free(Matcher *m);
+void match_find(const Matcher *m, const char *text, unsigned char *hits);
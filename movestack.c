@@ -2,23 +2,10 @@ void
 movestack(const Arg *arg) {
 	Client *c = NULL, *p = NULL, *pc = NULL, *i;
 
-	if(arg->i > 0) {
-		/* find the client after selmon->sel */
-		for(c = selmon->sel->next; c && (!ISVISIBLE(c) || c->isfloating); c = c->next);
-		if(!c)
-			for(c = selmon->clients; c && (!ISVISIBLE(c) || c->isfloating); c = c->next);
-
-	}
-	else {
-		/* find the client before selmon->sel */
-		for(i = selmon->clients; i != selmon->sel; i = i->next)
-			if(ISVISIBLE(i) && !i->isfloating)
-				c = i;
-		if(!c)
-			for(; i; i = i->next)
-				if(ISVISIBLE(i) && !i->isfloating)
-					c = i;
-	}
+	if(!selmon->sel)
+		return;
+	/* find the tiled client after or before selmon->sel */
+	c = nextvisible(selmon, selmon->sel, arg->i, 1);
 	/* find the client before selmon->sel and c */
 	for(i = selmon->clients; i && (!p || !pc); i = i->next) {
 		if(i->next == selmon->sel)
@@ -43,6 +30,7 @@ movestack(const Arg *arg) {
 		else if(c == selmon->clients)
 			selmon->clients = selmon->sel;
 
+		markclients(selmon);
 		arrange(selmon);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,412 @@
+/* See LICENSE file for copyright and license details. */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/wireless.h>
+#endif /* __linux__ */
+
+#include "status.h"
+#include "util.h"
+
+#define MODTEXT 64
+
+typedef struct {
+	const StatusModule *mod;
+	char text[MODTEXT];
+	long long due; /* ms since the epoch, -1 means only on events */
+} Module;
+
+static Module *modules;
+static size_t nmodules;
+static int powerfd = -1, netfd = -1;
+static int audiofd = -1, audiovol = -1, audiomuted;
+static pid_t audiopid = -1;
+static char audiobuf[256];
+static size_t audiolen;
+
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* refreshes are aligned to multiples of the interval, so a clock ticks
+ * right at the start of a second */
+static long long
+nextdue(const StatusModule *mod, long long t)
+{
+	long long iv = mod->interval * 1000LL;
+
+	return iv ? (t / iv + 1) * iv : -1;
+}
+
+static int
+readfile(const char *path, char *buf, size_t size)
+{
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r")))
+		return 0;
+	if (!fgets(buf, size, fp)) {
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 1;
+}
+
+/* prints the mute state and volume of the sink once and again whenever
+ * the server reports a change of a sink or of the default sink */
+static const char audioscript[] =
+	"vol() { pactl get-sink-mute \"$1\"; pactl get-sink-volume \"$1\"; }; "
+	"vol \"$1\"; pactl subscribe | while read -r l; do "
+	"case $l in *'on sink '*|*'on server'*) vol \"$1\";; esac; done";
+
+/* starts the audio child, its output is read from audiofd */
+static void
+startaudio(const char *sink)
+{
+	int fd[2];
+
+	if (pipe(fd) < 0)
+		return;
+	if ((audiopid = fork()) < 0) {
+		close(fd[0]);
+		close(fd[1]);
+		return;
+	}
+	if (audiopid == 0) {
+		setpgid(0, 0);
+		signal(SIGCHLD, SIG_DFL);
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[0]);
+		close(fd[1]);
+		execlp("sh", "sh", "-c", audioscript, "sh", sink, (char *)NULL);
+		_exit(127);
+	}
+	close(fd[1]);
+	fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL) | O_NONBLOCK);
+	audiofd = fd[0];
+	audiolen = 0;
+}
+
+/* reads what the audio child printed, returns StatusAudio if it reported
+ * the volume, closes audiofd once the child is gone */
+static unsigned int
+readaudio(void)
+{
+	char *line, *nl, *p;
+	ssize_t n;
+	unsigned int ev = 0;
+
+	while ((n = read(audiofd, audiobuf + audiolen, sizeof audiobuf - 1 - audiolen)) > 0) {
+		audiolen += n;
+		audiobuf[audiolen] = '\0';
+		/* "Mute: no", "Volume: front-left: 26214 /  40% / ..." */
+		for (line = audiobuf; (nl = strchr(line, '\n')); line = nl + 1) {
+			*nl = '\0';
+			if (!strncmp(line, "Mute:", 5)) {
+				audiomuted = strstr(line, "yes") != NULL;
+			} else if (!strncmp(line, "Volume:", 7) && (p = strchr(line, '%'))) {
+				while (p > line && p[-1] >= '0' && p[-1] <= '9')
+					p--;
+				audiovol = atoi(p);
+				ev |= StatusAudio;
+			}
+		}
+		/* keep a partial line, drop one too long to parse */
+		audiolen = line == audiobuf && audiolen == sizeof audiobuf - 1 ? 0 : strlen(line);
+		memmove(audiobuf, line, audiolen);
+	}
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+		close(audiofd);
+		audiofd = audiopid = -1;
+		audiovol = -1;
+		ev |= StatusAudio;
+	}
+	return ev;
+}
+
+#ifdef __linux__
+static int
+opennetlink(int proto, unsigned int groups)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	if ((fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, proto)) < 0)
+		return -1;
+	memset(&sa, 0, sizeof sa);
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+#endif /* __linux__ */
+
+/* drains a netlink socket, returns the events it carried */
+static unsigned int
+readnetlink(int fd, unsigned int event)
+{
+	char buf[8192];
+	ssize_t i, n;
+	unsigned int ev = 0;
+
+	while ((n = recv(fd, buf, sizeof buf - 1, 0)) > 0) {
+		if (event != StatusPower) {
+			ev |= event;
+			continue;
+		}
+		/* uevents are NUL separated KEY=value strings */
+		buf[n] = '\0';
+		for (i = 0; i < n; i += strlen(buf + i) + 1)
+			if (!strcmp(buf + i, "SUBSYSTEM=power_supply"))
+				ev |= StatusPower;
+	}
+	return ev;
+}
+
+void
+status_init(const StatusModule *mods, size_t modcount)
+{
+	size_t i;
+	unsigned int events = 0;
+	const char *sink = NULL;
+
+	modules = ecalloc(modcount, sizeof(Module));
+	nmodules = modcount;
+	for (i = 0; i < modcount; i++) {
+		modules[i].mod = &mods[i];
+		modules[i].due = 0; /* refresh right away */
+		events |= mods[i].events;
+		if (mods[i].events & StatusAudio)
+			sink = mods[i].arg;
+	}
+	if (events & StatusAudio)
+		startaudio(sink ? sink : "@DEFAULT_SINK@");
+#ifdef __linux__
+	if (events & StatusPower)
+		powerfd = opennetlink(NETLINK_KOBJECT_UEVENT, 1);
+	if (events & StatusNet)
+		netfd = opennetlink(NETLINK_ROUTE, RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR);
+#endif /* __linux__ */
+}
+
+void
+status_free(void)
+{
+	if (powerfd >= 0)
+		close(powerfd);
+	if (netfd >= 0)
+		close(netfd);
+	if (audiofd >= 0)
+		close(audiofd);
+	if (audiopid > 0)
+		kill(-audiopid, SIGTERM);
+	powerfd = netfd = audiofd = -1;
+	audiopid = -1;
+	free(modules);
+	modules = NULL;
+	nmodules = 0;
+}
+
+int
+status_pollfds(struct pollfd *fds, int n)
+{
+	int i = 0;
+
+	if (powerfd >= 0 && i < n) {
+		fds[i].fd = powerfd;
+		fds[i++].events = POLLIN;
+	}
+	if (netfd >= 0 && i < n) {
+		fds[i].fd = netfd;
+		fds[i++].events = POLLIN;
+	}
+	if (audiofd >= 0 && i < n) {
+		fds[i].fd = audiofd;
+		fds[i++].events = POLLIN;
+	}
+	return i;
+}
+
+/* milliseconds until the next module is due, -1 if none is */
+int
+status_timeout(void)
+{
+	size_t i;
+	long long t = now(), iv, due = -1;
+
+	for (i = 0; i < nmodules; i++) {
+		if (modules[i].due < 0)
+			continue;
+		/* the wall clock was set back */
+		iv = modules[i].mod->interval * 1000LL;
+		if (modules[i].due > t + iv)
+			modules[i].due = t;
+		if (due < 0 || modules[i].due < due)
+			due = modules[i].due;
+	}
+	if (due < 0)
+		return -1;
+	return due > t ? (int)(due - t) : 0;
+}
+
+/* refreshes the modules that are due or woken by an event and joins their
+ * texts into text, returns 1 if it changed */
+int
+status_update(const struct pollfd *fds, int n, char *text, size_t size, const char *sep)
+{
+	char buf[MODTEXT];
+	size_t i, len;
+	int j, changed = 0;
+	unsigned int events = 0;
+	long long t;
+
+	for (j = 0; fds && j < n; j++) {
+		if (!(fds[j].revents & (POLLIN | POLLHUP)))
+			continue;
+		if (fds[j].fd == powerfd)
+			events |= readnetlink(powerfd, StatusPower);
+		else if (fds[j].fd == netfd)
+			events |= readnetlink(netfd, StatusNet);
+		else if (fds[j].fd == audiofd)
+			events |= readaudio();
+	}
+
+	t = now();
+	for (i = 0; i < nmodules; i++) {
+		if (!(modules[i].mod->events & events)
+		&& (modules[i].due < 0 || modules[i].due > t))
+			continue;
+		modules[i].due = nextdue(modules[i].mod, t);
+		if (!modules[i].mod->func(buf, sizeof buf, modules[i].mod->arg))
+			buf[0] = '\0';
+		if (strcmp(buf, modules[i].text)) {
+			strcpy(modules[i].text, buf);
+			changed = 1;
+		}
+	}
+	if (!changed)
+		return 0;
+
+	text[0] = '\0';
+	for (i = 0, len = 0; i < nmodules && len < size; i++) {
+		if (!modules[i].text[0])
+			continue;
+		len += snprintf(text + len, size - len, "%s%s", len ? sep : "", modules[i].text);
+	}
+	return 1;
+}
+
+int
+status_battery(char *buf, size_t size, const char *arg)
+{
+	char path[128], cap[16], stat[32];
+
+	snprintf(path, sizeof path, "/sys/class/power_supply/%s/capacity", arg);
+	if (!readfile(path, cap, sizeof cap))
+		return 0;
+	snprintf(path, sizeof path, "/sys/class/power_supply/%s/status", arg);
+	if (!readfile(path, stat, sizeof stat))
+		stat[0] = '\0';
+	snprintf(buf, size, "%s %s%%", strcmp(stat, "Charging") ? "BAT" : "CHG", cap);
+	return 1;
+}
+
+int
+status_clock(char *buf, size_t size, const char *arg)
+{
+	time_t t = time(NULL);
+	struct tm tm;
+
+	if (!localtime_r(&t, &tm))
+		return 0;
+	return strftime(buf, size, arg, &tm) > 0;
+}
+
+int
+status_volume(char *buf, size_t size, const char *arg)
+{
+	if (audiovol < 0)
+		return 0;
+	if (audiomuted)
+		snprintf(buf, size, "VOL Muted");
+	else
+		snprintf(buf, size, "VOL %d%%", audiovol);
+	return 1;
+}
+
+int
+status_wifi(char *buf, size_t size, const char *arg)
+{
+#ifdef __linux__
+	char path[PATH_MAX], flags[32], essid[IW_ESSID_MAX_SIZE + 1] = "";
+	char ifname[IFNAMSIZ] = "";
+	struct iwreq wrq;
+	struct dirent *de;
+	DIR *dir;
+	int fd;
+
+	/* without an interface use the first one driven by cfg80211 */
+	if (arg) {
+		snprintf(ifname, sizeof ifname, "%s", arg);
+	} else if ((dir = opendir("/sys/class/net"))) {
+		while ((de = readdir(dir))) {
+			if (de->d_name[0] == '.' || strlen(de->d_name) >= sizeof ifname)
+				continue;
+			snprintf(path, sizeof path, "/sys/class/net/%s/phy80211", de->d_name);
+			if (!access(path, F_OK)) {
+				strcpy(ifname, de->d_name);
+				break;
+			}
+		}
+		closedir(dir);
+	}
+	if (!ifname[0])
+		return 0;
+
+	snprintf(path, sizeof path, "/sys/class/net/%s/flags", ifname);
+	if (!readfile(path, flags, sizeof flags))
+		return 0;
+	if (!(strtoul(flags, NULL, 16) & 0x1)) { /* IFF_UP */
+		snprintf(buf, size, "WIFI Off");
+		return 1;
+	}
+	if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0) {
+		memset(&wrq, 0, sizeof wrq);
+		snprintf(wrq.ifr_name, sizeof wrq.ifr_name, "%s", ifname);
+		wrq.u.essid.pointer = essid;
+		wrq.u.essid.length = IW_ESSID_MAX_SIZE;
+		if (ioctl(fd, SIOCGIWESSID, &wrq) < 0)
+			essid[0] = '\0';
+		close(fd);
+	}
+	snprintf(buf, size, "WIFI %s", essid[0] ? essid : "Disconnected");
+	return 1;
+#else
+	return 0;
+#endif /* __linux__ */
+}
@@ -0,0 +1,23 @@
+/* See LICENSE file for copyright and license details. */
+
+enum { StatusPower = 1 << 0, StatusNet = 1 << 1, StatusAudio = 1 << 2 }; /* events refreshing a module */
+
+typedef struct {
+	int (*func)(char *buf, size_t size, const char *arg);
+	const char *arg;
+	unsigned int interval; /* seconds between refreshes, 0 means only on events */
+	unsigned int events;
+} StatusModule;
+
+/* Status engine */
+void status_init(const StatusModule *mods, size_t modcount);
+void status_free(void);
+int status_pollfds(struct pollfd *fds, int n);
+int status_timeout(void);
+int status_update(const struct pollfd *fds, int n, char *text, size_t size, const char *sep);
+
+/* Modules, return 0 to hide the module */
+int status_battery(char *buf, size_t size, const char *arg);
+int status_clock(char *buf, size_t size, const char *arg);
+int status_volume(char *buf, size_t size, const char *arg);
+int status_wifi(char *buf, size_t size, const char *arg);